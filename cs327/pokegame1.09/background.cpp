@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "background.h"
+#include "poke327.h"
+#include "trace.h"
+
+/* A map the PC has left, and how far its background simulation has got */
+typedef struct background_map {
+  map_t *m;
+  uint32_t left;       /* world.turn_count when the PC left */
+  uint32_t steps;      /* Coarse steps run so far */
+  unsigned int rand;   /* This absence's random stream, for rand_r() */
+  int busy;            /* The worker is stepping it */
+} background_map_t;
+
+static uint32_t background_every;
+static uint32_t background_now;
+static uint32_t background_leaves;
+static int background_quit;
+/* Oldest first */
+static background_map_t background_map[BACKGROUND_MAPS];
+static uint32_t background_num_maps;
+static pthread_t background_worker;
+static pthread_mutex_t background_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t background_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t background_done = PTHREAD_COND_INITIALIZER;
+
+/* Steps b owes after the PC's now'th turn */
+static uint32_t background_target(const background_map_t *b, uint32_t now)
+{
+  uint32_t t;
+
+  t = (now - b->left) / background_every;
+
+  return t < BACKGROUND_MAX_STEPS ? t : BACKGROUND_MAX_STEPS;
+}
+
+/* One coarse step: each NPC tries one move the way its movement type   *
+ * would with nobody to chase or fight.  Hikers and rivals wander.      *
+ * Nobody steps onto the ring of cells inside the border, since that's  *
+ * where place_pc() puts the PC when it comes back.                     */
+static void background_step(map_t *m, unsigned int *seed)
+{
+  int32_t i;
+  int16_t *pos, *dir;
+  movement_type_t mtype;
+  int y, x, r, d;
+  int blocked;
+
+  for (i = 0; i < m->num_trainers; i++) {
+    pos = m->npcs.pos[i];
+    dir = m->npcs.dir[i];
+    mtype = m->npcs.mtype[i];
+    if (mtype == move_sentry) {
+      continue;
+    }
+
+    for (r = 0; r < 2; r++) {
+      y = pos[dim_y] + dir[dim_y];
+      x = pos[dim_x] + dir[dim_x];
+      if (mtype == move_walk) {
+        blocked = move_cost[char_other][m->map[y][x]] == INT_MAX;
+      } else {
+        blocked = m->map[y][x] != m->map[pos[dim_y]][pos[dim_x]];
+      }
+      blocked = (blocked || map_occupied(m, y, x) ||
+                 y < 2 || y > MAP_Y - 3 || x < 2 || x > MAP_X - 3);
+      if (!blocked) {
+        break;
+      }
+      if (!r) {
+        if (mtype == move_pace || mtype == move_walk) {
+          dir[dim_y] *= -1;
+          dir[dim_x] *= -1;
+        } else {
+          d = rand_r(seed) & 0x7;
+          dir[dim_y] = all_dirs[d][dim_y];
+          dir[dim_x] = all_dirs[d][dim_x];
+        }
+      }
+    }
+
+    if (!blocked) {
+      map_set_char(m, pos[dim_y], pos[dim_x], NULL);
+      pos[dim_y] = y;
+      pos[dim_x] = x;
+      map_set_char(m, y, x, m->trainer[i]);
+    }
+  }
+}
+
+static void *background_worker_func(void *)
+{
+  background_map_t *b;
+  map_t *m;
+  unsigned int seed;
+  uint32_t i;
+
+  pthread_mutex_lock(&background_lock);
+  while (!background_quit) {
+    /* Oldest first, since it's the nearest to being forced to catch up */
+    for (b = NULL, i = 0; i < background_num_maps; i++) {
+      if (background_map[i].steps <
+          background_target(background_map + i, background_now)) {
+        b = background_map + i;
+        break;
+      }
+    }
+    if (!b) {
+      pthread_cond_wait(&background_work, &background_lock);
+      continue;
+    }
+
+    b->busy = 1;
+    m = b->m;
+    seed = b->rand;
+    pthread_mutex_unlock(&background_lock);
+
+    {
+      trace_scope trace("background_step", "background");
+      background_step(m, &seed);
+    }
+
+    /* The list may have shifted under b, but m is still on it */
+    pthread_mutex_lock(&background_lock);
+    for (i = 0; background_map[i].m != m; i++)
+      ;
+    background_map[i].rand = seed;
+    background_map[i].steps++;
+    background_map[i].busy = 0;
+    pthread_cond_broadcast(&background_done);
+  }
+  pthread_mutex_unlock(&background_lock);
+
+  return NULL;
+}
+
+/* Takes entry i off the recent list and runs the steps it still owes. */
+static void background_finish(uint32_t i)
+{
+  background_map_t b;
+
+  while (background_map[i].busy) {
+    pthread_cond_wait(&background_done, &background_lock);
+  }
+  b = background_map[i];
+  memmove(background_map + i, background_map + i + 1,
+          (--background_num_maps - i) * sizeof (*background_map));
+  pthread_mutex_unlock(&background_lock);
+
+  for (; b.steps < background_target(&b, world.turn_count); b.steps++) {
+    background_step(b.m, &b.rand);
+  }
+
+  pthread_mutex_lock(&background_lock);
+}
+
+/* Starts simulating left maps once every every PC turns.  Returns 0 on *
+ * success, non-zero if the worker can't be started.                    */
+int background_start(uint32_t every)
+{
+  if (!every) {
+    return 0;
+  }
+
+  background_every = every;
+  if (pthread_create(&background_worker, NULL, background_worker_func, NULL)) {
+    perror("pthread_create");
+    background_every = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+void background_stop(void)
+{
+  if (!background_every) {
+    return;
+  }
+
+  pthread_mutex_lock(&background_lock);
+  background_quit = 1;
+  pthread_cond_signal(&background_work);
+  pthread_mutex_unlock(&background_lock);
+  pthread_join(background_worker, NULL);
+
+  background_every = 0;
+  background_num_maps = 0;
+}
+
+/* Called with the map the PC is leaving, before it arrives anywhere */
+void background_leave(map_t *m)
+{
+  background_map_t *b;
+
+  if (!background_every || !m) {
+    return;
+  }
+
+  pthread_mutex_lock(&background_lock);
+  if (background_num_maps == BACKGROUND_MAPS) {
+    background_finish(0);
+  }
+  b = background_map + background_num_maps++;
+  b->m = m;
+  b->left = world.turn_count;
+  b->steps = 0;
+  b->rand = world.seed ^ (world.turn_count * 2654435761U) ^
+            ++background_leaves;
+  b->busy = 0;
+  pthread_mutex_unlock(&background_lock);
+}
+
+/* Called with a map the PC is coming back to, before place_pc() */
+void background_enter(map_t *m)
+{
+  uint32_t i;
+
+  if (!background_every) {
+    return;
+  }
+
+  pthread_mutex_lock(&background_lock);
+  for (i = 0; i < background_num_maps; i++) {
+    if (background_map[i].m == m) {
+      background_finish(i);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&background_lock);
+}
+
+/* Called after each PC turn */
+void background_tick(void)
+{
+  if (!background_every) {
+    return;
+  }
+
+  pthread_mutex_lock(&background_lock);
+  background_now = world.turn_count;
+  pthread_cond_signal(&background_work);
+  pthread_mutex_unlock(&background_lock);
+}
@@ -0,0 +1,32 @@
+#ifndef BACKGROUND_H
+# define BACKGROUND_H
+
+# include <stdint.h>
+
+/* Opt-in (--background <turns>) low-fidelity simulation of maps the PC  *
+ * has recently left.  The last BACKGROUND_MAPS maps keep moving on a    *
+ * worker thread: every <turns> PC turns each of them owes one coarse    *
+ * step, in which every NPC but the sentries takes one move using only   *
+ * its own map (no pathfinding and no battles).  A map owes at most      *
+ * BACKGROUND_MAX_STEPS steps per absence, which bounds the work, and    *
+ * the worker is the only extra thread, which bounds the CPU it takes.   *
+ *                                                                       *
+ * The worker only ever gets ahead of the PC by less than a step, never  *
+ * behind the rule: when the PC comes back (or the map falls off the     *
+ * recent list), whatever steps the map still owes are run right then,   *
+ * on the game's thread.  Each absence has its own random stream, so a   *
+ * map ends up the same however far the worker got, and a recording      *
+ * replays exactly as long as it's played with the same --background.    */
+
+# define BACKGROUND_MAPS      8
+# define BACKGROUND_MAX_STEPS 200
+
+typedef struct map map_t;
+
+int background_start(uint32_t every);
+void background_stop(void);
+void background_leave(map_t *m);
+void background_enter(map_t *m);
+void background_tick(void);
+
+#endif
@@ -0,0 +1,329 @@
+#include <stdlib.h>
+#include <limits.h>
+#include <cmath>
+#include <algorithm>
+
+#include "battle.h"
+#include "poke327.h"
+#include "pokemon.h"
+#include "db_parse.h"
+
+static inline int battle_rand(unsigned int *seed)
+{
+  return seed ? rand_r(seed) : rand();
+}
+
+/* Returns random integer in [min, max], like rand_range() */
+static inline int battle_range(unsigned int *seed, int min, int max)
+{
+  return (battle_rand(seed) % ((max + 1) - min)) + min;
+}
+
+// returns 0 if move hits, 1 if move misses
+int do_battle_move(pokemon *attacker, pokemon *defender, int move_index,
+                   unsigned int *seed)
+{
+  const move_db *m = &attacker->get_db()->moves[move_index];
+  int level, power, attack, defense, random;
+  float critical, stab, type;
+
+  if (battle_rand(seed) % 100 >= m->accuracy) {
+    return 1;
+  }
+
+  /* Status moves have no power (INT_MAX from the database) and do no *
+   * damage.  Letting INT_MAX into the formula below overflows.       */
+  if (m->power == INT_MAX) {
+    return 0;
+  }
+
+  level = attacker->get_level();
+  power = m->power;
+  attack = attacker->get_atk();
+  defense = defender->get_def();
+  critical = (battle_range(seed, 0, 255) < attacker->get_crit_threshold()) ? 1.5 : 1.0;
+  random = battle_range(seed, 85, 100);
+  type = defender->get_type_factor(m->type_id) / 100.0;
+  stab = attacker->has_type(m->type_id) ? 1.5 : 1.0;
+
+  float move_damage_float = ((((2 * level) / 5 + 2) * power * (attack / defense)) / 50 + 2) * critical * random * stab * type;
+  int move_damage = ((int) std::round(move_damage_float)) / 100;
+
+  defender->set_hp(std::max(defender->get_hp() - move_damage, 0));
+
+  return 0;
+}
+
+/* One lane per move slot.  GCC and clang compile arithmetic on these   *
+ * to whatever vector instructions the target has, with no intrinsics.  */
+typedef int battle_v4i __attribute__ ((vector_size (4 * sizeof (int))));
+typedef float battle_v4f __attribute__ ((vector_size (4 * sizeof (float))));
+
+/* do_battle_move()'s damage for each of attacker's move slots against  *
+ * defender, averaged over its rolls: the accuracy check, the critical  *
+ * hit and the 85-100 random factor.  Slots the attacker doesn't have,  *
+ * and status moves, expect nothing.                                    */
+static battle_v4f battle_expect(const pokemon *attacker,
+                                const pokemon *defender)
+{
+  const move_db *moves = attacker->get_db()->moves;
+  battle_v4i power, base;
+  battle_v4f hit, stab, type;
+  float critical;
+  int i, m;
+
+  for (i = 0; i < 4; i++) {
+    if (i < attacker->get_num_moves() &&
+        moves[m = attacker->get_move_index(i)].power != INT_MAX) {
+      power[i] = moves[m].power;
+      hit[i] = std::min(moves[m].accuracy, 100) / 100.0f;
+      stab[i] = attacker->has_type(moves[m].type_id) ? 1.5f : 1.0f;
+      type[i] = defender->get_type_factor(moves[m].type_id) / 100.0f;
+    } else {
+      power[i] = 0;
+      hit[i] = stab[i] = type[i] = 0.0f;
+    }
+  }
+
+  /* Integer, like do_battle_move(), right up to the multipliers */
+  base = ((((2 * attacker->get_level()) / 5 + 2) * power *
+           (attacker->get_atk() / defender->get_def())) / 50 + 2);
+  critical = (1.0f + 0.5f * std::min(attacker->get_crit_threshold(), 256) /
+              256.0f);
+
+  return (__builtin_convertvector(base, battle_v4f) *
+          (critical * 0.925f) * stab * type * hit);
+}
+
+void battle_expected_damage(const pokemon *attacker, const pokemon *defender,
+                            float damage[4])
+{
+  battle_v4f d;
+  int i;
+
+  d = battle_expect(attacker, defender);
+  for (i = 0; i < 4; i++) {
+    damage[i] = d[i];
+  }
+}
+
+/* The first slot expecting the most damage, and that damage */
+static int battle_argmax(battle_v4f d, float *damage)
+{
+  int i, best;
+
+  for (best = 0, i = 1; i < 4; i++) {
+    if (d[i] > d[best]) {
+      best = i;
+    }
+  }
+  if (damage) {
+    *damage = d[best];
+  }
+
+  return best;
+}
+
+int battle_best_move(const pokemon *attacker, const pokemon *defender)
+{
+  return battle_argmax(battle_expect(attacker, defender), NULL);
+}
+
+void battle_score(const pokemon *const *attacker,
+                  const pokemon *const *defender, int n,
+                  int *slot, float *damage)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    slot[i] = battle_argmax(battle_expect(attacker[i], defender[i]),
+                            damage + i);
+  }
+}
+
+void battle_init(battle_t *b, pokemon *pc_party, int pc_size,
+                 pokemon *foe_party, int foe_size, int *bag)
+{
+  b->party[battle_pc] = pc_party;
+  b->size[battle_pc] = pc_size;
+  b->party[battle_foe] = foe_party;
+  b->size[battle_foe] = foe_size;
+  b->bag = bag;
+  b->escape_attempts = 0;
+  b->over = 0;
+  b->fled = 0;
+}
+
+/* If side's pokemon has fainted, brings in another one.  Returns 1 if *
+ * there's nobody left.  Every pokemon still standing is swapped into  *
+ * the front in turn, so the last of them ends up fighting.            */
+static int battle_faint(battle_t *b, battle_side_t side)
+{
+  pokemon *p = b->party[side];
+  int i;
+
+  if (p[0].get_hp() == 0) {
+    for (i = 0; i < b->size[side]; i++) {
+      if (p[i].get_hp() > 0) {
+        std::swap(p[0], p[i]);
+      }
+    }
+
+    return p[0].get_hp() == 0;
+  }
+
+  return 0;
+}
+
+/* side attacks with move slot; returns the number of events made */
+static int battle_attack(battle_t *b, battle_side_t side, int slot,
+                         unsigned int *seed, battle_event_t *event)
+{
+  battle_side_t other = side == battle_pc ? battle_foe : battle_pc;
+  pokemon *attacker = b->party[side];
+  pokemon *defender = b->party[other];
+  int n = 0;
+
+  /* A pokemon too young to know any move can't attack at all */
+  if (!attacker->get_num_moves()) {
+    return 0;
+  }
+
+  if (slot == BATTLE_RANDOM_MOVE) {
+    slot = battle_range(seed, 0, attacker->get_num_moves() - 1);
+  } else if (slot == BATTLE_BEST_MOVE || slot >= attacker->get_num_moves()) {
+    /* A slot picked for a pokemon that has since fainted may be one its *
+     * replacement doesn't have.                                         */
+    slot = battle_best_move(attacker, defender);
+  }
+
+  event[n].type = battle_event_use;
+  event[n].side = side;
+  event[n].db = attacker->get_db();
+  event[n].species = attacker->get_pokemon_species_index();
+  event[n].move = attacker->get_move_index(slot);
+  event[n].hp = attacker->get_hp();
+  n++;
+
+  event[n] = event[n - 1];
+  event[n].type = (do_battle_move(attacker, defender, event[n].move, seed) ?
+                   battle_event_miss : battle_event_hit);
+  event[n].db = defender->get_db();
+  event[n].species = defender->get_pokemon_species_index();
+  event[n].hp = defender->get_hp();
+  n++;
+
+  if (battle_faint(b, other)) {
+    event[n].type = battle_event_over;
+    event[n].side = other;
+    n++;
+    b->over = 1;
+  }
+
+  return n;
+}
+
+/* A side that's going to pick its move at random goes by the priority *
+ * of its first move, as the game always has.                          */
+static int battle_priority(const pokemon *p, int slot, const pokemon *other)
+{
+  if (slot == BATTLE_RANDOM_MOVE) {
+    slot = 0;
+  } else if (slot == BATTLE_BEST_MOVE) {
+    slot = battle_best_move(p, other);
+  }
+
+  return p->get_db()->moves[p->get_move_index(slot)].priority;
+}
+
+/* Plays one round.  Returns the number of events written to event,    *
+ * at most BATTLE_MAX_EVENTS.  Anything but fighting (an item, a       *
+ * switch, running) happens first, then whoever is fighting attacks:   *
+ * the higher move priority goes first, then the faster pokemon, then  *
+ * a coin flip.                                                        */
+int battle_step(battle_t *b, battle_action_t pc, battle_action_t foe,
+                unsigned int *seed, battle_event_t *event)
+{
+  pokemon *p = b->party[battle_pc];
+  pokemon *f = b->party[battle_foe];
+  int n = 0;
+  int cmp, odds, divisor;
+  battle_side_t first;
+
+  switch (pc.type) {
+  case battle_action_fight:
+    break;
+  case battle_action_potion:
+    p->set_hp(std::min(p->get_max_hp(), p->get_hp() + 20));
+    b->bag[item_potion]--;
+    break;
+  case battle_action_revive:
+    p->set_hp(p->get_max_hp() / 2);
+    b->bag[item_revive]--;
+    break;
+  case battle_action_switch:
+    std::swap(p[0], p[pc.index]);
+    break;
+  case battle_action_run:
+    b->escape_attempts++;
+    /* The divisor is zero against a very slow foe; that always escapes */
+    divisor = (f->get_speed() / 4) % 256;
+    odds = (divisor ? (p->get_speed() * 32) / divisor : 256) +
+           30 * b->escape_attempts;
+    event[n].side = battle_pc;
+    event[n].db = p->get_db();
+    event[n].species = p->get_pokemon_species_index();
+    event[n].hp = p->get_hp();
+    if (battle_rand(seed) % 256 < odds) {
+      event[n].type = battle_event_fled;
+      b->over = b->fled = 1;
+    } else {
+      /* Trying to run costs nothing; the foe doesn't get a free hit */
+      event[n].type = battle_event_trapped;
+    }
+    return ++n;
+  }
+
+  if (pc.type == battle_action_potion || pc.type == battle_action_revive) {
+    event[n].type = (pc.type == battle_action_potion ?
+                     battle_event_potion : battle_event_revive);
+    event[n].side = battle_pc;
+    event[n].db = p->get_db();
+    event[n].species = p->get_pokemon_species_index();
+    event[n].hp = p->get_hp();
+    n++;
+  }
+
+  if (foe.type == battle_action_switch) {
+    std::swap(f[0], f[foe.index]);
+  }
+
+  if (pc.type == battle_action_fight && foe.type == battle_action_fight) {
+    cmp = (battle_priority(p, pc.index, f) -
+           battle_priority(f, foe.index, p));
+    if (!cmp) {
+      cmp = p->get_speed() - f->get_speed();
+    }
+    if (cmp > 0) {
+      first = battle_pc;
+    } else if (cmp < 0) {
+      first = battle_foe;
+    } else {
+      first = battle_range(seed, 0, 1) == 1 ? battle_pc : battle_foe;
+    }
+
+    n += battle_attack(b, first, first == battle_pc ? pc.index : foe.index,
+                       seed, event + n);
+    if (!b->over) {
+      n += battle_attack(b, first == battle_pc ? battle_foe : battle_pc,
+                         first == battle_pc ? foe.index : pc.index,
+                         seed, event + n);
+    }
+  } else if (pc.type == battle_action_fight) {
+    n += battle_attack(b, battle_pc, pc.index, seed, event + n);
+  } else if (foe.type == battle_action_fight) {
+    n += battle_attack(b, battle_foe, foe.index, seed, event + n);
+  }
+
+  return n;
+}
@@ -0,0 +1,102 @@
+#ifndef BATTLE_H
+# define BATTLE_H
+
+/* The rules of trainer and wild battles, with no I/O.                    *
+ *                                                                        *
+ * A battle is two parties, the PC's and the foe's, each an array whose   *
+ * first pokemon is the one fighting.  battle_step() plays one round:     *
+ * given what each side does, it updates both parties (and the PC's bag)  *
+ * and reports what happened as a list of events, in order, which is all  *
+ * a front end needs to show the round.  io.cpp draws them with ncurses;  *
+ * anything that only wants the outcome can ignore them.                  *
+ *                                                                        *
+ * Every random number comes from rand_r(seed), or from rand() if seed is *
+ * NULL.  The game passes NULL, so its battles draw from the same stream  *
+ * as everything else and recordings still replay.                        */
+
+class pokemon;
+struct db_version;
+
+typedef enum battle_side {
+  battle_pc,
+  battle_foe,
+  num_battle_sides
+} battle_side_t;
+
+typedef enum battle_action_type {
+  battle_action_fight,  /* Use move slot index */
+  battle_action_potion, /* PC only; restores 20 hp */
+  battle_action_revive, /* PC only; brings a fainted pokemon back at half */
+  battle_action_switch, /* Swap party slot index into the fight */
+  battle_action_run,    /* PC only, wild battles only */
+} battle_action_type_t;
+
+/* A side fighting with this slot picks one of its moves at random when *
+ * its turn comes, which is what every NPC and wild pokemon does.       */
+# define BATTLE_RANDOM_MOVE -1
+/* A side fighting with this slot uses the move battle_best_move() picks *
+ * against whatever it's facing when its turn comes, as trainers do.     */
+# define BATTLE_BEST_MOVE   -2
+
+typedef struct battle_action {
+  battle_action_type_t type;
+  int index;
+} battle_action_t;
+
+typedef enum battle_event_type {
+  battle_event_use,     /* side's species used move */
+  battle_event_hit,     /* side's move hit; species and hp are the target's */
+  battle_event_miss,    /* As hit, for a miss */
+  battle_event_potion,  /* species and hp are the PC's pokemon's, after */
+  battle_event_revive,  /* As potion */
+  battle_event_fled,
+  battle_event_trapped, /* A failed run */
+  battle_event_over     /* side has no pokemon left standing */
+} battle_event_type_t;
+
+/* Events carry indices into species[] and moves[] rather than pointers, *
+ * since a fainted pokemon is switched out before the step returns.      *
+ * They index db's tables, the version the pokemon was made under.       */
+typedef struct battle_event {
+  battle_event_type_t type;
+  battle_side_t side;
+  const db_version *db;
+  int species;
+  int move;
+  int hp;
+} battle_event_t;
+
+/* The most events one step can make: two attacks of two events each, *
+ * and the end of the battle.                                         */
+# define BATTLE_MAX_EVENTS 5
+
+typedef struct battle {
+  pokemon *party[num_battle_sides];
+  int size[num_battle_sides];
+  int *bag;             /* The PC's bag_items[] */
+  int escape_attempts;
+  int over;             /* Someone ran out of pokemon, or the PC fled */
+  int fled;
+} battle_t;
+
+void battle_init(battle_t *b, pokemon *pc_party, int pc_size,
+                 pokemon *foe_party, int foe_size, int *bag);
+int battle_step(battle_t *b, battle_action_t pc, battle_action_t foe,
+                unsigned int *seed, battle_event_t *event);
+int do_battle_move(pokemon *attacker, pokemon *defender, int move_index,
+                   unsigned int *seed);
+
+/* Move choice by expected damage: do_battle_move()'s formula averaged  *
+ * over its random rolls, worked out for all four move slots at once.   *
+ * Slots the attacker doesn't have, and status moves, expect 0.         *
+ * battle_best_move() returns the first slot expecting the most, and    *
+ * battle_score() does the same for each of n attacker/defender pairs,  *
+ * also giving the damage the chosen move expects.                      */
+void battle_expected_damage(const pokemon *attacker, const pokemon *defender,
+                            float damage[4]);
+int battle_best_move(const pokemon *attacker, const pokemon *defender);
+void battle_score(const pokemon *const *attacker,
+                  const pokemon *const *defender, int n,
+                  int *slot, float *damage);
+
+#endif
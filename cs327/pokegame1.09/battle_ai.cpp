@@ -0,0 +1,355 @@
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+#include "battle_ai.h"
+#include "pokemon.h"
+#include "db_parse.h"
+
+/* A won (or lost) battle is worth more than any hp difference */
+#define BATTLE_AI_WIN 4.0f
+
+/* How many positions to search between looks at the clock */
+#define BATTLE_AI_CLOCK_EVERY 256
+
+/* One move slot of one pokemon against one of the other side's */
+typedef struct battle_ai_attack {
+  int damage;          /* Expected damage when it hits */
+  float hit;           /* Chance it hits */
+  int priority;
+} battle_ai_attack_t;
+
+/* Everything about the two parties that stays put during the search.  *
+ * Pokemon are numbered by where they were in their party at the root. */
+typedef struct battle_ai_game {
+  battle_side_t me;
+  int size[num_battle_sides];
+  int max_hp[num_battle_sides][BATTLE_AI_PARTY];
+  int speed[num_battle_sides][BATTLE_AI_PARTY];
+  int num_moves[num_battle_sides][BATTLE_AI_PARTY];
+  battle_ai_attack_t attack[num_battle_sides][BATTLE_AI_PARTY]
+                           [BATTLE_AI_PARTY][4];
+  /* The slot battle_best_move() picks, for each attacker and defender */
+  int best[num_battle_sides][BATTLE_AI_PARTY][BATTLE_AI_PARTY];
+} battle_ai_game_t;
+
+/* All that changes: hp, and the party order battle_faint() shuffles */
+typedef struct battle_ai_state {
+  int16_t hp[num_battle_sides][BATTLE_AI_PARTY];
+  uint8_t order[num_battle_sides][BATTLE_AI_PARTY];
+} battle_ai_state_t;
+
+typedef struct battle_ai_entry {
+  uint64_t key;
+  uint32_t generation;  /* Entries from earlier decisions are stale */
+  int depth;
+  float value;
+} battle_ai_entry_t;
+
+static uint64_t battle_ai_ns;
+static uint64_t battle_ai_deadline;
+static uint64_t battle_ai_max_nodes;
+static uint64_t battle_ai_nodes;
+static int battle_ai_out_of_budget;
+static uint32_t battle_ai_generation;
+static battle_ai_game_t battle_ai_game;
+static battle_ai_entry_t battle_ai_table[BATTLE_AI_TABLE_SIZE];
+
+static uint64_t battle_ai_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* FNV-1a over the state */
+static uint64_t battle_ai_hash(const battle_ai_state_t *s)
+{
+  const unsigned char *p = (const unsigned char *) s;
+  uint64_t h = 14695981039346656037ULL;
+  uint32_t i;
+
+  for (i = 0; i < sizeof (*s); i++) {
+    h = (h ^ p[i]) * 1099511628211ULL;
+  }
+
+  return h;
+}
+
+/* Remaining hp of me less the other side's, each as a fraction of its *
+ * party's total max hp.                                               */
+static float battle_ai_eval(const battle_ai_state_t *s)
+{
+  float v[num_battle_sides];
+  int side, i, hp, max;
+
+  for (side = 0; side < num_battle_sides; side++) {
+    for (hp = max = 0, i = 0; i < battle_ai_game.size[side]; i++) {
+      hp += s->hp[side][i];
+      max += battle_ai_game.max_hp[side][i];
+    }
+    v[side] = max ? (float) hp / max : 0.0f;
+  }
+
+  return v[battle_ai_game.me] - v[!battle_ai_game.me];
+}
+
+/* As battle_faint(); returns 1 if side has nobody left */
+static int battle_ai_faint(battle_ai_state_t *s, int side)
+{
+  uint8_t *order = s->order[side];
+  int i;
+
+  if (!s->hp[side][order[0]]) {
+    for (i = 0; i < battle_ai_game.size[side]; i++) {
+      if (s->hp[side][order[i]]) {
+        std::swap(order[0], order[i]);
+      }
+    }
+
+    return !s->hp[side][order[0]];
+  }
+
+  return 0;
+}
+
+static float battle_ai_value(const battle_ai_state_t *s, int depth);
+
+/* The value of s with the rest of a round to play: attack number turn *
+ * (0 or 1) of the round, first's attack being number 0, then another  *
+ * depth - 1 rounds.                                                   */
+static float battle_ai_attack(const battle_ai_state_t *s, const int *slot,
+                              int first, int turn, int depth)
+{
+  const battle_ai_attack_t *a;
+  battle_ai_state_t t;
+  float hit;
+  int side, attacker, defender, n;
+
+  if (turn == 2) {
+    return battle_ai_value(s, depth - 1);
+  }
+
+  side = turn ? !first : first;
+  attacker = s->order[side][0];
+  defender = s->order[!side][0];
+  if (!(n = battle_ai_game.num_moves[side][attacker])) {
+    return battle_ai_attack(s, slot, first, turn + 1, depth);
+  }
+
+  /* A pokemon switched in mid-round may not have the slot; the game *
+   * uses its best move then (battle_attack()), and so does this.    */
+  a = &battle_ai_game.attack[side][attacker][defender]
+                            [slot[side] < n ? slot[side] :
+                             battle_ai_game.best[side][attacker][defender]];
+  if (!a->damage || !a->hit) {
+    return battle_ai_attack(s, slot, first, turn + 1, depth);
+  }
+
+  t = *s;
+  t.hp[!side][defender] = std::max(t.hp[!side][defender] - a->damage, 0);
+  if (battle_ai_faint(&t, !side)) {
+    hit = side == battle_ai_game.me ? BATTLE_AI_WIN : -BATTLE_AI_WIN;
+  } else {
+    hit = battle_ai_attack(&t, slot, first, turn + 1, depth);
+  }
+
+  if (a->hit >= 1.0f) {
+    return hit;
+  }
+
+  return (a->hit * hit +
+          (1.0f - a->hit) * battle_ai_attack(s, slot, first, turn + 1, depth));
+}
+
+/* A round where both sides use slot, as battle_step() orders it */
+static float battle_ai_round(const battle_ai_state_t *s, const int *slot,
+                             int depth)
+{
+  int p[num_battle_sides];
+  int side, i, n, cmp;
+
+  for (side = 0; side < num_battle_sides; side++) {
+    i = s->order[side][0];
+    n = battle_ai_game.num_moves[side][i];
+    p[side] = (n ? battle_ai_game.attack[side][i][s->order[!side][0]]
+                                        [slot[side]].priority : 0);
+  }
+
+  if (!(cmp = p[battle_pc] - p[battle_foe])) {
+    cmp = (battle_ai_game.speed[battle_pc][s->order[battle_pc][0]] -
+           battle_ai_game.speed[battle_foe][s->order[battle_foe][0]]);
+  }
+  if (cmp > 0) {
+    return battle_ai_attack(s, slot, battle_pc, 0, depth);
+  } else if (cmp < 0) {
+    return battle_ai_attack(s, slot, battle_foe, 0, depth);
+  }
+
+  return 0.5f * (battle_ai_attack(s, slot, battle_pc, 0, depth) +
+                 battle_ai_attack(s, slot, battle_foe, 0, depth));
+}
+
+/* The value of s at the start of a round, with my move in slot, the *
+ * other side replying as badly for me as it can.                    */
+static float battle_ai_reply(const battle_ai_state_t *s, int mine, int depth)
+{
+  int slot[num_battle_sides];
+  int me = battle_ai_game.me;
+  int n;
+  float v, worst;
+
+  n = battle_ai_game.num_moves[!me][s->order[!me][0]];
+  slot[me] = mine;
+  slot[!me] = 0;
+  worst = battle_ai_round(s, slot, depth);
+  for (slot[!me] = 1; slot[!me] < n && !battle_ai_out_of_budget; slot[!me]++) {
+    v = battle_ai_round(s, slot, depth);
+    if (v < worst) {
+      worst = v;
+    }
+  }
+
+  return worst;
+}
+
+/* The value of s at the start of a round, depth rounds from the end *
+ * of the search.                                                    */
+static float battle_ai_value(const battle_ai_state_t *s, int depth)
+{
+  battle_ai_entry_t *e;
+  uint64_t key;
+  int me = battle_ai_game.me;
+  int i, n;
+  float v, best;
+
+  if (!depth || battle_ai_out_of_budget) {
+    return battle_ai_eval(s);
+  }
+
+  /* The node count ends the search; the clock only caps it */
+  if (++battle_ai_nodes > battle_ai_max_nodes ||
+      (!(battle_ai_nodes % BATTLE_AI_CLOCK_EVERY) &&
+       battle_ai_now() > battle_ai_deadline)) {
+    battle_ai_out_of_budget = 1;
+    return 0.0f;
+  }
+
+  key = battle_ai_hash(s);
+  e = battle_ai_table + (key & (BATTLE_AI_TABLE_SIZE - 1));
+  if (e->key == key && e->generation == battle_ai_generation &&
+      e->depth >= depth) {
+    return e->value;
+  }
+
+  n = battle_ai_game.num_moves[me][s->order[me][0]];
+  best = battle_ai_reply(s, 0, depth);
+  for (i = 1; i < n; i++) {
+    v = battle_ai_reply(s, i, depth);
+    if (v > best) {
+      best = v;
+    }
+  }
+
+  if (!battle_ai_out_of_budget) {
+    e->key = key;
+    e->generation = battle_ai_generation;
+    e->depth = depth;
+    e->value = best;
+  }
+
+  return best;
+}
+
+void battle_ai_budget(uint32_t ms)
+{
+  battle_ai_ns = ms * 1000000ULL;
+  battle_ai_max_nodes = ms * (uint64_t) BATTLE_AI_NODES_PER_MS;
+}
+
+/* Fills in battle_ai_game and the root state from b */
+static void battle_ai_setup(const battle_t *b, battle_side_t me,
+                            battle_ai_state_t *s)
+{
+  battle_ai_game_t *g = &battle_ai_game;
+  const pokemon *p, *q;
+  const move_db *moves;
+  float damage[4];
+  int side, i, j, k, m;
+
+  memset(s, 0, sizeof (*s));
+  g->me = me;
+  for (side = 0; side < num_battle_sides; side++) {
+    g->size[side] = std::min(b->size[side], BATTLE_AI_PARTY);
+    for (i = 0; i < g->size[side]; i++) {
+      p = b->party[side] + i;
+      s->hp[side][i] = p->get_hp();
+      s->order[side][i] = i;
+      g->max_hp[side][i] = p->get_max_hp();
+      g->speed[side][i] = p->get_speed();
+      g->num_moves[side][i] = p->get_num_moves();
+    }
+  }
+
+  for (side = 0; side < num_battle_sides; side++) {
+    for (i = 0; i < g->size[side]; i++) {
+      p = b->party[side] + i;
+      moves = p->get_db()->moves;
+      for (j = 0; j < g->size[!side]; j++) {
+        q = b->party[!side] + j;
+        battle_expected_damage(p, q, damage);
+        for (g->best[side][i][j] = 0, k = 1; k < 4; k++) {
+          if (damage[k] > damage[g->best[side][i][j]]) {
+            g->best[side][i][j] = k;
+          }
+        }
+        for (k = 0; k < g->num_moves[side][i]; k++) {
+          m = p->get_move_index(k);
+          g->attack[side][i][j][k].hit = std::min(moves[m].accuracy, 100) /
+                                         100.0f;
+          g->attack[side][i][j][k].damage =
+            (g->attack[side][i][j][k].hit ?
+             (int) (damage[k] / g->attack[side][i][j][k].hit + 0.5f) : 0);
+          g->attack[side][i][j][k].priority = moves[m].priority;
+        }
+      }
+    }
+  }
+}
+
+int battle_ai_move(const battle_t *b, battle_side_t side)
+{
+  battle_ai_state_t s;
+  float v, best;
+  int depth, slot, deepest, i, n;
+
+  if (!battle_ai_ns || !(n = b->party[side]->get_num_moves())) {
+    return BATTLE_BEST_MOVE;
+  }
+
+  battle_ai_deadline = battle_ai_now() + battle_ai_ns;
+  battle_ai_out_of_budget = 0;
+  battle_ai_nodes = 0;
+  battle_ai_generation++;
+  battle_ai_setup(b, side, &s);
+
+  /* If not even one round fits in the budget, fall back on damage */
+  deepest = BATTLE_BEST_MOVE;
+  for (depth = 1; depth <= BATTLE_AI_MAX_DEPTH; depth++) {
+    for (slot = 0, best = 0.0f, i = 0; i < n; i++) {
+      v = battle_ai_reply(&s, i, depth);
+      if (!i || v > best) {
+        best = v;
+        slot = i;
+      }
+    }
+    if (battle_ai_out_of_budget) {
+      break;
+    }
+    deepest = slot;
+  }
+
+  return deepest;
+}
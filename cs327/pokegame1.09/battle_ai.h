@@ -0,0 +1,41 @@
+#ifndef BATTLE_AI_H
+# define BATTLE_AI_H
+
+# include <stdint.h>
+
+# include "battle.h"
+
+/* Opt-in (--battle-ai <ms>) look-ahead for trainers' moves.              *
+ *                                                                        *
+ * battle_ai_move() searches the coming rounds by expectiminimax: the     *
+ * trainer picks the move that does best against the PC's worst reply,    *
+ * with a chance node for each roll that matters (whether an attack hits, *
+ * and the coin flip between equally fast pokemon).  Damage is            *
+ * battle_expected_damage()'s average, rounded, and the PC is assumed to  *
+ * always fight.  The value of a position is the difference in the two    *
+ * parties' remaining hp, as fractions of their max hp.                   *
+ *                                                                        *
+ * The search deepens one round at a time until the budget runs out, and  *
+ * plays the move from the deepest round it finished.  Positions are      *
+ * cached in a transposition table keyed on a hash of every pokemon's hp  *
+ * and the party order, which is all that changes during a battle.  With  *
+ * no budget it returns BATTLE_BEST_MOVE, so the old behavior is free.    *
+ *                                                                        *
+ * The budget is counted in positions searched, BATTLE_AI_NODES_PER_MS    *
+ * for each millisecond, so the same battle gets the same move on any     *
+ * machine and a recording replays exactly.  The clock is only a hard     *
+ * cap: the search never blocks for longer than the budget (plus one      *
+ * leaf's worth).  Only a machine too slow to search that many positions  *
+ * in the time ever hits the cap, and there the move can vary.            *
+ * The table is static: one thread at a time.                             */
+
+# define BATTLE_AI_PARTY      6        /* Bigger parties are cut short */
+# define BATTLE_AI_MAX_DEPTH  16       /* In rounds */
+# define BATTLE_AI_TABLE_SIZE (1 << 14) /* Entries; a power of two */
+/* A quarter of what a current desktop searches in a millisecond */
+# define BATTLE_AI_NODES_PER_MS 4096
+
+void battle_ai_budget(uint32_t ms);
+int battle_ai_move(const battle_t *b, battle_side_t side);
+
+#endif
@@ -0,0 +1,413 @@
+/**************************************************************************
+ * Monte Carlo battle simulator, for balancing trainer parties.           *
+ *                                                                        *
+ * Plays many battles between two sides, "pc" and "foe", with the game's  *
+ * own rules (battle.h), each side fighting with random moves the way     *
+ * wild pokemon do or with its best moves the way trainers do.  Each      *
+ * side is a party of random or named species, at a fixed level or a      *
+ * random one in [1, 100].  The results are written as CSV: win rates     *
+ * by the two sides' level brackets, and by species.                      *
+ *                                                                        *
+ * Battles are dealt out in chunks to a pool of threads.  Every chunk     *
+ * draws from its own rand_r() stream, seeded from the seed and the       *
+ * chunk's number, so the tables depend only on the seed and the number   *
+ * of battles, not on the number of threads or how the chunks fell.       *
+ **************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <vector>
+#include <atomic>
+
+#include "pokemon.h"
+#include "db_parse.h"
+#include "battle.h"
+
+#define BATTLESIM_CHUNK      4096
+/* Two sides with nothing but status moves would never finish */
+#define BATTLESIM_MAX_ROUNDS 1000
+#define BATTLESIM_MAX_PARTY  6
+#define BATTLESIM_LEVELS     100
+#define BATTLESIM_SPECIES    db_size(db_pokemon_species_csv)
+
+typedef struct battlesim_side {
+  int level;                            /* 0 for random */
+  int moves;                            /* BATTLE_RANDOM_MOVE or _BEST_ */
+  int size;
+  int species[BATTLESIM_MAX_PARTY];     /* 0 for random */
+} battlesim_side_t;
+
+/* Wins, losses and draws, always from the point of view of the pc side *
+ * for the level table and of the species for the species table.        */
+typedef struct battlesim_count {
+  uint64_t win, loss, draw;
+} battlesim_count_t;
+
+typedef struct battlesim_table {
+  battlesim_count_t by_level[BATTLESIM_LEVELS][BATTLESIM_LEVELS];
+  battlesim_count_t *by_species;        /* [BATTLESIM_SPECIES] */
+} battlesim_table_t;
+
+static battlesim_side_t battlesim_side[num_battle_sides];
+static uint64_t battlesim_battles;
+static uint32_t battlesim_seed;
+static std::atomic<uint64_t> battlesim_next_chunk;
+static battlesim_table_t battlesim_total;
+static pthread_mutex_t battlesim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void battlesim_add(battlesim_count_t *c, int result)
+{
+  if (result > 0) {
+    c->win++;
+  } else if (result < 0) {
+    c->loss++;
+  } else {
+    c->draw++;
+  }
+}
+
+/* Plays one battle and counts it in t */
+static void battlesim_battle(battlesim_table_t *t, unsigned int *seed,
+                             std::vector<pokemon> *party)
+{
+  battle_event_t event[BATTLE_MAX_EVENTS];
+  battle_action_t action[num_battle_sides];
+  battle_t b;
+  int level[num_battle_sides];
+  int start[num_battle_sides][BATTLESIM_MAX_PARTY];
+  int side, i, n, rounds, result;
+
+  for (side = 0; side < num_battle_sides; side++) {
+    level[side] = (battlesim_side[side].level ?
+                   battlesim_side[side].level :
+                   rand_r(seed) % BATTLESIM_LEVELS + 1);
+    party[side].clear();
+    for (i = 0; i < battlesim_side[side].size; i++) {
+      party[side].push_back(pokemon(level[side],
+                                    battlesim_side[side].species[i], seed));
+    }
+  }
+
+  battle_init(&b, party[battle_pc].data(), battlesim_side[battle_pc].size,
+              party[battle_foe].data(), battlesim_side[battle_foe].size, NULL);
+  for (side = 0; side < num_battle_sides; side++) {
+    action[side].type = battle_action_fight;
+    action[side].index = battlesim_side[side].moves;
+  }
+
+  /* Species are counted as they started, before any switching */
+  for (side = 0; side < num_battle_sides; side++) {
+    for (i = 0; i < battlesim_side[side].size; i++) {
+      start[side][i] = party[side][i].get_pokemon_species_index();
+    }
+  }
+
+  result = 0;
+  for (rounds = 0; !b.over && rounds < BATTLESIM_MAX_ROUNDS; rounds++) {
+    n = battle_step(&b, action[battle_pc], action[battle_foe], seed, event);
+    if (b.over) {
+      result = event[n - 1].side == battle_foe ? 1 : -1;
+    }
+  }
+
+  battlesim_add(&t->by_level[level[battle_pc] - 1][level[battle_foe] - 1],
+                result);
+  for (side = 0; side < num_battle_sides; side++) {
+    for (i = 0; i < battlesim_side[side].size; i++) {
+      battlesim_add(&t->by_species[start[side][i]],
+                    side == battle_pc ? result : -result);
+    }
+  }
+}
+
+static void *battlesim_worker(void *)
+{
+  battlesim_table_t *t;
+  std::vector<pokemon> party[num_battle_sides];
+  unsigned int seed;
+  uint64_t chunk, i, end;
+  int j, k;
+
+  t = (battlesim_table_t *) calloc(1, sizeof (*t));
+  t->by_species = ((battlesim_count_t *)
+                   calloc(BATTLESIM_SPECIES, sizeof (*t->by_species)));
+
+  while ((chunk = battlesim_next_chunk.fetch_add(1)) * BATTLESIM_CHUNK <
+         battlesim_battles) {
+    seed = battlesim_seed ^ (uint32_t) (chunk * 2654435761U);
+    end = (chunk + 1) * BATTLESIM_CHUNK;
+    if (end > battlesim_battles) {
+      end = battlesim_battles;
+    }
+    for (i = chunk * BATTLESIM_CHUNK; i < end; i++) {
+      battlesim_battle(t, &seed, party);
+    }
+  }
+
+  pthread_mutex_lock(&battlesim_lock);
+  for (j = 0; j < BATTLESIM_LEVELS; j++) {
+    for (k = 0; k < BATTLESIM_LEVELS; k++) {
+      battlesim_total.by_level[j][k].win += t->by_level[j][k].win;
+      battlesim_total.by_level[j][k].loss += t->by_level[j][k].loss;
+      battlesim_total.by_level[j][k].draw += t->by_level[j][k].draw;
+    }
+  }
+  for (j = 0; j < BATTLESIM_SPECIES; j++) {
+    battlesim_total.by_species[j].win += t->by_species[j].win;
+    battlesim_total.by_species[j].loss += t->by_species[j].loss;
+    battlesim_total.by_species[j].draw += t->by_species[j].draw;
+  }
+  pthread_mutex_unlock(&battlesim_lock);
+
+  free(t->by_species);
+  free(t);
+
+  return NULL;
+}
+
+static void battlesim_row(FILE *out, const char *table, const char *key,
+                          const char *vs, const battlesim_count_t *c)
+{
+  uint64_t n = c->win + c->loss + c->draw;
+
+  if (n) {
+    fprintf(out, "%s,%s,%s,%lu,%lu,%lu,%lu,%.4f\n", table, key, vs,
+            (unsigned long) n, (unsigned long) c->win,
+            (unsigned long) c->loss, (unsigned long) c->draw,
+            (double) c->win / n);
+  }
+}
+
+static void battlesim_write(FILE *out, int bracket)
+{
+  battlesim_count_t c;
+  char key[24], vs[24]; /* Two ints and a dash */
+  int i, j, k, l;
+
+  fprintf(out, "table,key,vs,battles,wins,losses,draws,win_rate\n");
+
+  /* Level brackets, pc's against foe's, as the pc side saw them */
+  for (i = 0; i < BATTLESIM_LEVELS; i += bracket) {
+    for (j = 0; j < BATTLESIM_LEVELS; j += bracket) {
+      memset(&c, 0, sizeof (c));
+      for (k = i; k < i + bracket && k < BATTLESIM_LEVELS; k++) {
+        for (l = j; l < j + bracket && l < BATTLESIM_LEVELS; l++) {
+          c.win += battlesim_total.by_level[k][l].win;
+          c.loss += battlesim_total.by_level[k][l].loss;
+          c.draw += battlesim_total.by_level[k][l].draw;
+        }
+      }
+      snprintf(key, sizeof (key), "%d-%d", i + 1,
+               i + bracket < BATTLESIM_LEVELS ? i + bracket : BATTLESIM_LEVELS);
+      snprintf(vs, sizeof (vs), "%d-%d", j + 1,
+               j + bracket < BATTLESIM_LEVELS ? j + bracket : BATTLESIM_LEVELS);
+      battlesim_row(out, "level", key, vs, &c);
+    }
+  }
+
+  /* Each species, whichever side it fought on */
+  for (i = 1; i < BATTLESIM_SPECIES; i++) {
+    battlesim_row(out, "species", species[i].identifier, "",
+                  &battlesim_total.by_species[i]);
+  }
+}
+
+/* Parses a comma separated list of species (names or numbers, or "random") *
+ * into s.  Returns 0 on success, non-zero on failure.                      */
+static int battlesim_parse_party(char *list, battlesim_side_t *s)
+{
+  char *name;
+  int i;
+
+  for (s->size = 0, name = strtok(list, ","); name;
+       name = strtok(NULL, ",")) {
+    if (s->size == BATTLESIM_MAX_PARTY) {
+      fprintf(stderr, "A party has at most %d pokemon\n", BATTLESIM_MAX_PARTY);
+      return 1;
+    }
+    if (!strcmp(name, "random")) {
+      i = 0;
+    } else if (!(i = atoi(name)) && !(i = db_find_species(name))) {
+      i = -1;
+    }
+    if (i < 0 || i >= BATTLESIM_SPECIES) {
+      fprintf(stderr, "No such species: %s\n", name);
+      return 1;
+    }
+    s->species[s->size++] = i;
+  }
+
+  return !s->size;
+}
+
+static void usage(char *s)
+{
+  fprintf(stderr, "Usage: %s [-s|--seed <seed>] [-n|--battles <battles>]\n"
+          "          [-j|--threads <threads>] [-o|--output <file>]\n"
+          "          [-b|--bracket <levels>] [--pc-level <level>] "
+          "[--foe-level <level>]\n"
+          "          [--pc <species,...>] [--foe <species,...>]\n"
+          "          [--pc-moves <random|best>] [--foe-moves <random|best>]\n",
+          s);
+
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  struct timeval start, end;
+  double elapsed;
+  uint32_t threads, bracket;
+  uint64_t battles;
+  char *pc_party, *foe_party;
+  std::vector<pthread_t> pool;
+  int long_arg;
+  int i, side;
+  FILE *out;
+
+  battlesim_seed = 1;
+  battles = 1000000;
+  threads = sysconf(_SC_NPROCESSORS_ONLN);
+  bracket = 10;
+  pc_party = foe_party = NULL;
+  out = stdout;
+  for (side = 0; side < num_battle_sides; side++) {
+    battlesim_side[side].level = 0;
+    battlesim_side[side].moves = BATTLE_RANDOM_MOVE;
+    battlesim_side[side].size = 1;
+    battlesim_side[side].species[0] = 0;
+  }
+
+  for (i = 1, long_arg = 0; i < argc; i++, long_arg = 0) {
+    if (argv[i][0] == '-') { /* All switches start with a dash */
+      if (argv[i][1] == '-') {
+        argv[i]++;    /* Make the argument have a single dash so we can */
+        long_arg = 1; /* handle long and short args at the same place.  */
+      }
+      switch (argv[i][1]) {
+      case 's':
+        if ((!long_arg && argv[i][2]) ||
+            (long_arg && strcmp(argv[i], "-seed")) ||
+            argc < ++i + 1 /* No more arguments */ ||
+            !sscanf(argv[i], "%u", &battlesim_seed)) {
+          usage(argv[0]);
+        }
+        break;
+      case 'n':
+        if ((!long_arg && argv[i][2]) ||
+            (long_arg && strcmp(argv[i], "-battles")) ||
+            argc < ++i + 1 /* No more arguments */ ||
+            !sscanf(argv[i], "%lu", (unsigned long *) &battles)) {
+          usage(argv[0]);
+        }
+        break;
+      case 'j':
+        if ((!long_arg && argv[i][2]) ||
+            (long_arg && strcmp(argv[i], "-threads")) ||
+            argc < ++i + 1 /* No more arguments */ ||
+            !sscanf(argv[i], "%u", &threads) || !threads) {
+          usage(argv[0]);
+        }
+        break;
+      case 'b':
+        if ((!long_arg && argv[i][2]) ||
+            (long_arg && strcmp(argv[i], "-bracket")) ||
+            argc < ++i + 1 /* No more arguments */ ||
+            !sscanf(argv[i], "%u", &bracket) || !bracket) {
+          usage(argv[0]);
+        }
+        break;
+      case 'o':
+        if ((!long_arg && argv[i][2]) ||
+            (long_arg && strcmp(argv[i], "-output")) ||
+            argc < ++i + 1 /* No more arguments */) {
+          usage(argv[0]);
+        }
+        if (!(out = fopen(argv[i], "w"))) {
+          perror(argv[i]);
+          return 1;
+        }
+        break;
+      case 'p':
+      case 'f':
+        side = argv[i][1] == 'p' ? battle_pc : battle_foe;
+        if (!long_arg || argc < i + 2 /* No more arguments */) {
+          usage(argv[0]);
+        }
+        if (!strcmp(argv[i], "-pc-level") || !strcmp(argv[i], "-foe-level")) {
+          if (!sscanf(argv[++i], "%d", &battlesim_side[side].level) ||
+              battlesim_side[side].level < 1 ||
+              battlesim_side[side].level > BATTLESIM_LEVELS) {
+            usage(argv[0]);
+          }
+        } else if (!strcmp(argv[i], "-pc-moves") ||
+                   !strcmp(argv[i], "-foe-moves")) {
+          i++;
+          if (!strcmp(argv[i], "random")) {
+            battlesim_side[side].moves = BATTLE_RANDOM_MOVE;
+          } else if (!strcmp(argv[i], "best")) {
+            battlesim_side[side].moves = BATTLE_BEST_MOVE;
+          } else {
+            usage(argv[0]);
+          }
+        } else if (!strcmp(argv[i], "-pc")) {
+          pc_party = argv[++i];
+        } else if (!strcmp(argv[i], "-foe")) {
+          foe_party = argv[++i];
+        } else {
+          usage(argv[0]);
+        }
+        break;
+      default:
+        usage(argv[0]);
+      }
+    } else { /* No dash */
+      usage(argv[0]);
+    }
+  }
+
+  db_parse(false);
+  pokemon_load_all_species();
+  battlesim_total.by_species =
+    ((battlesim_count_t *)
+     calloc(BATTLESIM_SPECIES, sizeof (*battlesim_total.by_species)));
+
+  if ((pc_party && battlesim_parse_party(pc_party, battlesim_side + battle_pc)) ||
+      (foe_party &&
+       battlesim_parse_party(foe_party, battlesim_side + battle_foe))) {
+    return 1;
+  }
+
+  battlesim_battles = battles;
+  gettimeofday(&start, NULL);
+
+  pool.resize(threads);
+  for (i = 0; i < (int) threads; i++) {
+    if (pthread_create(&pool[i], NULL, battlesim_worker, NULL)) {
+      perror("pthread_create");
+      return 1;
+    }
+  }
+  for (i = 0; i < (int) threads; i++) {
+    pthread_join(pool[i], NULL);
+  }
+
+  gettimeofday(&end, NULL);
+  elapsed = ((end.tv_sec - start.tv_sec) +
+             (end.tv_usec - start.tv_usec) / 1000000.0);
+  fprintf(stderr, "%lu battles in %.3fs (%.0f battles/s) on %u threads\n",
+          (unsigned long) battles, elapsed,
+          elapsed > 0 ? battles / elapsed : 0.0, threads);
+
+  battlesim_write(out, bracket);
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  return 0;
+}
@@ -0,0 +1,647 @@
+/**************************************************************************
+ * Microbenchmarks for the game's hot paths.                              *
+ *                                                                        *
+ * Links against the headless objects, so it measures exactly the code    *
+ * the game runs.  Every benchmark reseeds rand() with the same seed      *
+ * before it starts, so runs are repeatable and independent of which      *
+ * other benchmarks were selected.  A benchmark runs a few warmup samples *
+ * that are thrown away, then times each of its samples; a sample is      *
+ * batch calls of the operation, and the reported figures are per call.   *
+ * Results are written as JSON (stdout, or -o file) for tracking          *
+ * regressions from one version to the next.                              *
+ **************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <vector>
+#include <algorithm>
+
+#include "heap.h"
+#include "poke327.h"
+#include "io.h"
+#include "pokemon.h"
+#include "db_parse.h"
+#include "battle.h"
+#include "battle_ai.h"
+
+/* Nodes in the heap benchmark; the same as the cells pathfind() uses. */
+#define BENCH_HEAP_SIZE ((MAP_Y - 2) * (MAP_X - 2))
+
+/* Characters in the turn order benchmarks, a crowded map's worth, and *
+ * the turns taken per call.                                           */
+#define BENCH_TURN_CHARS 256
+#define BENCH_TURNS      10000
+
+/* Pokemon on each side in the battle benchmark, a full party */
+#define BENCH_BATTLE_PARTY 6
+
+/* Attacker/defender pairs scored per call in the move choice benchmark */
+#define BENCH_SCORE_PAIRS 256
+
+/* Budget for the look-ahead benchmark, the one the README suggests */
+#define BENCH_AI_MS 2
+
+typedef struct benchmark {
+  const char *name;
+  /* Runs the operation batch times and returns the nanoseconds spent *
+   * in the operation itself, leaving out any per-call setup.         */
+  uint64_t (*func)(uint32_t batch);
+  uint32_t warmup;
+  uint32_t samples;
+  uint32_t batch;
+} benchmark_t;
+
+static inline uint64_t bench_now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t bench_db_parse(uint32_t batch)
+{
+  uint64_t start;
+  uint32_t i;
+
+  start = bench_now();
+  for (i = 0; i < batch; i++) {
+    db_parse(false);
+  }
+
+  return bench_now() - start;
+}
+
+/* One call is every lookup over the pokedex's indexes (db_parse.h)  *
+ * once: a random pokemon, move and species by id and by identifier, *
+ * a random type by name, and the pokemon that learn the move.       */
+static uint64_t bench_db_lookup(uint32_t batch)
+{
+  const uint16_t *learners;
+  uint64_t total;
+  uint32_t i;
+  int p, m, s, t;
+
+  for (total = 0, i = 0; i < batch; i++) {
+    p = rand_range(1, db_size(db_pokemon_csv));
+    m = rand_range(1, db_size(db_moves_csv));
+    s = rand_range(1, db_size(db_pokemon_species_csv));
+    t = rand_range(1, 18);
+    total -= bench_now();
+    db_pokemon_row(pokemondb[p].id);
+    db_move_row(moves[m].id);
+    db_species_row(species[s].id);
+    db_find_pokemon(pokemondb[p].identifier);
+    db_find_move(moves[m].identifier);
+    db_find_species(species[s].identifier);
+    db_find_type(types[t]);
+    db_move_learners(moves[m].id, &learners);
+    total += bench_now();
+  }
+
+  return total;
+}
+
+/* First pokemon of a species builds that species' move list from  *
+ * pokemon_moves; that cache is cleared so every call pays for it. */
+static uint64_t bench_pokemon_cold(uint32_t batch)
+{
+  uint64_t total;
+  uint32_t i, j;
+  pokemon *p;
+
+  for (total = 0, i = 0; i < batch; i++) {
+    for (j = 0; j < (uint32_t) db_size(db_pokemon_species_csv); j++) {
+      species[j].levelup_moves.clear();
+      species[j].loaded = false;
+    }
+    total -= bench_now();
+    p = new pokemon(rand_range(1, 100));
+    total += bench_now();
+    delete p;
+  }
+
+  return total;
+}
+
+static uint64_t bench_pokemon(uint32_t batch)
+{
+  uint64_t total;
+  uint32_t i;
+  pokemon *p;
+
+  for (total = 0, i = 0; i < batch; i++) {
+    total -= bench_now();
+    p = new pokemon(rand_range(1, 100));
+    total += bench_now();
+    delete p;
+  }
+
+  return total;
+}
+
+typedef struct bench_heap_node {
+  heap_node_t *hn;
+  int32_t key;
+} bench_heap_node_t;
+
+static int32_t bench_heap_cmp(const void *key, const void *with)
+{
+  return (((const bench_heap_node_t *) key)->key -
+          ((const bench_heap_node_t *) with)->key);
+}
+
+/* One call fills a heap and drains it, decreasing the keys of two   *
+ * random nodes still in the heap after each removal, about the mix  *
+ * of operations Dijkstra's algorithm makes on a map.                */
+static uint64_t bench_heap(uint32_t batch)
+{
+  static bench_heap_node_t n[BENCH_HEAP_SIZE];
+  bench_heap_node_t *min;
+  uint64_t total;
+  uint32_t i, j, k;
+  heap_t h;
+
+  for (total = 0, i = 0; i < batch; i++) {
+    total -= bench_now();
+    heap_init(&h, bench_heap_cmp, NULL);
+    for (j = 0; j < BENCH_HEAP_SIZE; j++) {
+      n[j].key = rand() % 10000 + 10000;
+      n[j].hn = heap_insert(&h, &n[j]);
+    }
+    while ((min = (bench_heap_node_t *) heap_remove_min(&h))) {
+      min->hn = NULL;
+      for (j = 0; j < 2; j++) {
+        k = rand() % BENCH_HEAP_SIZE;
+        if (n[k].hn && n[k].key > min->key) {
+          n[k].key -= (n[k].key - min->key) / 2;
+          heap_decrease_key_no_replace(&h, n[k].hn);
+        }
+      }
+    }
+    heap_delete(&h);
+    total += bench_now();
+  }
+
+  return total;
+}
+
+/* Turn costs drawn the way a map full of trainers would draw them */
+static int bench_turn_cost()
+{
+  static const int cost[] = { 10, 10, 10, 15, 20, 20, 50 };
+
+  return cost[rand() % (sizeof (cost) / sizeof (cost[0]))];
+}
+
+/* A character's place in the heap the maps used before turn_queue_t. *
+ * seq counts inserts, so ties come out in the order they went in,    *
+ * the order turn_queue_t gives them.                                 */
+typedef struct bench_turn {
+  int next_turn;
+  uint32_t seq;
+} bench_turn_t;
+
+static int32_t bench_cmp_turns(const void *key, const void *with)
+{
+  const bench_turn_t *k = (const bench_turn_t *) key;
+  const bench_turn_t *w = (const bench_turn_t *) with;
+
+  if (k->next_turn != w->next_turn) {
+    return k->next_turn - w->next_turn;
+  }
+
+  return k->seq < w->seq ? -1 : 1;
+}
+
+/* The turn loop's use of its queue: take the next character and put *
+ * it back a move later.  This is the Fibonacci heap the maps used   *
+ * before turn_queue_t, for comparison.                              */
+static uint64_t bench_turn_heap(uint32_t batch)
+{
+  static bench_turn_t c[BENCH_TURN_CHARS];
+  static int cost[BENCH_TURNS];
+  bench_turn_t *next;
+  uint64_t total;
+  uint32_t i, j, seq;
+  heap_t h;
+
+  for (total = 0, i = 0; i < batch; i++) {
+    for (j = 0; j < BENCH_TURNS; j++) {
+      cost[j] = bench_turn_cost();
+    }
+    heap_init(&h, bench_cmp_turns, NULL);
+    for (seq = 0, j = 0; j < BENCH_TURN_CHARS; j++) {
+      c[j].next_turn = 0;
+      c[j].seq = seq++;
+      heap_insert(&h, &c[j]);
+    }
+    total -= bench_now();
+    for (j = 0; j < BENCH_TURNS; j++) {
+      next = (bench_turn_t *) heap_remove_min(&h);
+      next->next_turn += cost[j];
+      next->seq = seq++;
+      heap_insert(&h, next);
+    }
+    total += bench_now();
+    heap_delete(&h);
+  }
+
+  return total;
+}
+
+/* The same with turn_queue_t, each character's next turn kept by slot *
+ * the way map_npcs_t keeps them.                                      */
+static uint64_t bench_turn_queue(uint32_t batch)
+{
+  static npc c[BENCH_TURN_CHARS];
+  static int next_turn[BENCH_TURN_CHARS];
+  static int cost[BENCH_TURNS];
+  static turn_queue_t q;
+  npc *next;
+  uint64_t total;
+  uint32_t i, j;
+
+  for (total = 0, i = 0; i < batch; i++) {
+    for (j = 0; j < BENCH_TURNS; j++) {
+      cost[j] = bench_turn_cost();
+    }
+    turn_queue_init(&q);
+    for (j = 0; j < BENCH_TURN_CHARS; j++) {
+      c[j].slot = j;
+      next_turn[j] = 0;
+      turn_queue_insert(&q, &c[j], 0);
+    }
+    total -= bench_now();
+    for (j = 0; j < BENCH_TURNS; j++) {
+      next = (npc *) turn_queue_remove_min(&q);
+      next_turn[next->slot] += cost[j];
+      turn_queue_insert(&q, next, next_turn[next->slot]);
+    }
+    total += bench_now();
+  }
+
+  return total;
+}
+
+static uint64_t bench_pathfind(uint32_t batch)
+{
+  uint64_t start;
+  uint32_t i;
+
+  start = bench_now();
+  for (i = 0; i < batch; i++) {
+    pathfind(world.cur_map);
+  }
+
+  return bench_now() - start;
+}
+
+/* Carves the west to east road across a copy of the starting map.  *
+ * The search only looks at heights, so the copy is representative. */
+static uint64_t bench_dijkstra_path(uint32_t batch)
+{
+  static map_t m;
+  pair_t from, to;
+  uint64_t total;
+  uint32_t i;
+
+  from[dim_x] = 1;
+  from[dim_y] = world.cur_map->w;
+  to[dim_x] = MAP_X - 2;
+  to[dim_y] = world.cur_map->e;
+
+  for (total = 0, i = 0; i < batch; i++) {
+    memcpy(m.map, world.cur_map->map, sizeof (m.map));
+    memcpy(m.height, world.cur_map->height, sizeof (m.height));
+    total -= bench_now();
+    dijkstra_path(&m, from, to);
+    total += bench_now();
+  }
+
+  return total;
+}
+
+/* Generates the map east of the start, trainers and all, and throws *
+ * it away again, so every call builds a map from nothing.           */
+static uint64_t bench_new_map(uint32_t batch)
+{
+  map_t *start_map;
+  pair_t start_idx, pc_pos;
+  uint64_t total;
+  uint32_t i;
+
+  start_map = world.cur_map;
+  start_idx[dim_x] = world.cur_idx[dim_x];
+  start_idx[dim_y] = world.cur_idx[dim_y];
+  pc_pos[dim_x] = world.pc.pos[dim_x];
+  pc_pos[dim_y] = world.pc.pos[dim_y];
+
+  for (total = 0, i = 0; i < batch; i++) {
+    world.cur_idx[dim_x] = start_idx[dim_x] + 1;
+    total -= bench_now();
+    new_map(0);
+    total += bench_now();
+    turn_queue_delete(&world.cur_map->turn);
+    free(world.cur_map);
+    world.world[world.cur_idx[dim_y]][world.cur_idx[dim_x]] = NULL;
+    world.pc.pos[dim_x] = pc_pos[dim_x];
+    world.pc.pos[dim_y] = pc_pos[dim_y];
+  }
+
+  world.cur_idx[dim_x] = start_idx[dim_x];
+  world.cur_map = start_map;
+
+  return total;
+}
+
+static uint64_t bench_do_battle_move(uint32_t batch)
+{
+  pokemon *attacker, *defender;
+  uint64_t total;
+  uint32_t i;
+  int move;
+
+  /* Need a move that does damage, or this only times the accuracy roll */
+  attacker = NULL;
+  do {
+    delete attacker;
+    attacker = new pokemon(50);
+    move = attacker->get_move_index(0);
+  } while (moves[move].power == INT_MAX);
+  defender = new pokemon(50);
+
+  for (total = 0, i = 0; i < batch; i++) {
+    defender->set_hp(defender->get_max_hp());
+    total -= bench_now();
+    do_battle_move(attacker, defender, move, NULL);
+    total += bench_now();
+  }
+
+  delete attacker;
+  delete defender;
+
+  return total;
+}
+
+/* One call is one round of a battle between two full parties of level  *
+ * 50 pokemon, both sides fighting with random moves and drawing from   *
+ * their own rand_r() stream, the way a battle simulator would.  A new  *
+ * battle starts, untimed, whenever one ends.                           */
+static uint64_t bench_battle_step(uint32_t batch)
+{
+  std::vector<pokemon> party[num_battle_sides];
+  battle_event_t event[BATTLE_MAX_EVENTS];
+  battle_action_t action;
+  battle_t b;
+  unsigned int seed;
+  uint64_t total;
+  uint32_t i;
+  int side, j;
+
+  seed = rand();
+  action.type = battle_action_fight;
+  action.index = BATTLE_RANDOM_MOVE;
+  b.over = 1;
+
+  for (total = 0, i = 0; i < batch; i++) {
+    if (b.over) {
+      for (side = 0; side < num_battle_sides; side++) {
+        party[side].clear();
+        for (j = 0; j < BENCH_BATTLE_PARTY; j++) {
+          party[side].push_back(pokemon(50));
+        }
+      }
+      battle_init(&b, party[battle_pc].data(), BENCH_BATTLE_PARTY,
+                  party[battle_foe].data(), BENCH_BATTLE_PARTY, NULL);
+    }
+    total -= bench_now();
+    battle_step(&b, action, action, &seed, event);
+    total += bench_now();
+  }
+
+  return total;
+}
+
+/* One call is picking the best move for BENCH_SCORE_PAIRS attacker/ *
+ * defender pairs of level 50 pokemon with battle_score().           */
+static uint64_t bench_battle_score(uint32_t batch)
+{
+  std::vector<pokemon> party[num_battle_sides];
+  const pokemon *attacker[BENCH_SCORE_PAIRS], *defender[BENCH_SCORE_PAIRS];
+  int slot[BENCH_SCORE_PAIRS];
+  float damage[BENCH_SCORE_PAIRS];
+  uint64_t total;
+  uint32_t i;
+  int j;
+
+  for (j = 0; j < BENCH_SCORE_PAIRS; j++) {
+    party[battle_pc].push_back(pokemon(50));
+    party[battle_foe].push_back(pokemon(50));
+  }
+  for (j = 0; j < BENCH_SCORE_PAIRS; j++) {
+    attacker[j] = &party[battle_pc][j];
+    defender[j] = &party[battle_foe][j];
+  }
+
+  for (total = 0, i = 0; i < batch; i++) {
+    total -= bench_now();
+    battle_score(attacker, defender, BENCH_SCORE_PAIRS, slot, damage);
+    total += bench_now();
+  }
+
+  return total;
+}
+
+/* One call is a trainer's look-ahead move choice, with a budget of   *
+ * BENCH_AI_MS, between two full parties of level 50 pokemon.  The    *
+ * search ends after BENCH_AI_MS * BATTLE_AI_NODES_PER_MS positions   *
+ * (battle_ai.h), or at BENCH_AI_MS on a machine too slow to search   *
+ * that many, so on most machines a call comes in well under the      *
+ * budget.                                                            */
+static uint64_t bench_battle_ai(uint32_t batch)
+{
+  std::vector<pokemon> party[num_battle_sides];
+  battle_t b;
+  uint64_t total;
+  uint32_t i;
+  int side, j;
+
+  for (side = 0; side < num_battle_sides; side++) {
+    for (j = 0; j < BENCH_BATTLE_PARTY; j++) {
+      party[side].push_back(pokemon(50));
+    }
+  }
+  battle_init(&b, party[battle_pc].data(), BENCH_BATTLE_PARTY,
+              party[battle_foe].data(), BENCH_BATTLE_PARTY, NULL);
+
+  battle_ai_budget(BENCH_AI_MS);
+  for (total = 0, i = 0; i < batch; i++) {
+    total -= bench_now();
+    battle_ai_move(&b, battle_foe);
+    total += bench_now();
+  }
+  battle_ai_budget(0);
+
+  return total;
+}
+
+static const benchmark_t benchmarks[] = {
+  /* name                 function              warmup samples batch */
+  { "db_parse",           bench_db_parse,       1,     5,      1    },
+  { "db_lookup",          bench_db_lookup,      10,    200,    1000 },
+  { "pokemon_new_cold",   bench_pokemon_cold,   2,     50,     1    },
+  { "pokemon_new",        bench_pokemon,        50,    200,    100  },
+  { "heap_mix",           bench_heap,           10,    200,    1    },
+  { "turn_heap",          bench_turn_heap,      10,    200,    1    },
+  { "turn_queue",         bench_turn_queue,     10,    200,    1    },
+  { "pathfind",           bench_pathfind,       10,    200,    1    },
+  { "dijkstra_path",      bench_dijkstra_path,  10,    200,    1    },
+  { "new_map",            bench_new_map,        5,     100,    1    },
+  { "do_battle_move",     bench_do_battle_move, 10,    200,    1000 },
+  { "battle_step",        bench_battle_step,    10,    200,    1000 },
+  { "battle_score",       bench_battle_score,   10,    200,    100  },
+  { "battle_ai",          bench_battle_ai,      2,     50,     1    },
+};
+
+#define num_benchmarks ((int) (sizeof (benchmarks) / sizeof (benchmarks[0])))
+
+/* Nearest-rank percentile of sorted samples */
+static double percentile(const std::vector<double> &v, double p)
+{
+  uint32_t i;
+
+  i = (uint32_t) (p * v.size() + 0.999999);
+
+  return v[i ? i - 1 : 0];
+}
+
+static void run_benchmark(const benchmark_t *b, uint32_t seed,
+                          FILE *out, int first)
+{
+  std::vector<double> v;
+  double sum;
+  uint32_t i;
+
+  srand(seed);
+
+  for (i = 0; i < b->warmup; i++) {
+    b->func(b->batch);
+  }
+  for (i = 0; i < b->samples; i++) {
+    v.push_back((double) b->func(b->batch) / b->batch);
+  }
+
+  std::sort(v.begin(), v.end());
+  for (sum = 0, i = 0; i < v.size(); i++) {
+    sum += v[i];
+  }
+
+  fprintf(out, "%s\n    { \"name\": \"%s\", \"warmup\": %u, "
+          "\"samples\": %u, \"batch\": %u,\n"
+          "      \"min\": %.1f, \"median\": %.1f, \"p90\": %.1f, "
+          "\"p99\": %.1f, \"max\": %.1f, \"mean\": %.1f }",
+          first ? "" : ",", b->name, b->warmup, b->samples, b->batch,
+          v.front(), percentile(v, 0.5), percentile(v, 0.9),
+          percentile(v, 0.99), v.back(), sum / v.size());
+  fflush(out);
+
+  fprintf(stderr, "%-20s median %12.1f ns  p99 %12.1f ns\n",
+          b->name, percentile(v, 0.5), percentile(v, 0.99));
+}
+
+static void usage(char *s)
+{
+  fprintf(stderr, "Usage: %s [-s|--seed <seed>] [-o|--output <file>] "
+          "[benchmark...]\n\nBenchmarks:", s);
+  for (int i = 0; i < num_benchmarks; i++) {
+    fprintf(stderr, " %s", benchmarks[i].name);
+  }
+  fprintf(stderr, "\n");
+
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t seed;
+  int long_arg;
+  int i, j;
+  FILE *out;
+  std::vector<const benchmark_t *> selected;
+
+  seed = 1;
+  out = stdout;
+
+  for (i = 1, long_arg = 0; i < argc; i++, long_arg = 0) {
+    if (argv[i][0] == '-') { /* All switches start with a dash */
+      if (argv[i][1] == '-') {
+        argv[i]++;    /* Make the argument have a single dash so we can */
+        long_arg = 1; /* handle long and short args at the same place.  */
+      }
+      switch (argv[i][1]) {
+      case 's':
+        if ((!long_arg && argv[i][2]) ||
+            (long_arg && strcmp(argv[i], "-seed")) ||
+            argc < ++i + 1 /* No more arguments */ ||
+            !sscanf(argv[i], "%u", &seed) /* Argument is not an integer */) {
+          usage(argv[0]);
+        }
+        break;
+      case 'o':
+        if ((!long_arg && argv[i][2]) ||
+            (long_arg && strcmp(argv[i], "-output")) ||
+            argc < ++i + 1 /* No more arguments */) {
+          usage(argv[0]);
+        }
+        if (!(out = fopen(argv[i], "w"))) {
+          perror(argv[i]);
+          return 1;
+        }
+        break;
+      default:
+        usage(argv[0]);
+      }
+    } else { /* No dash: a benchmark to run */
+      for (j = 0; j < num_benchmarks && strcmp(argv[i], benchmarks[j].name);
+           j++)
+        ;
+      if (j == num_benchmarks) {
+        usage(argv[0]);
+      }
+      selected.push_back(&benchmarks[j]);
+    }
+  }
+
+  if (selected.empty()) {
+    for (j = 0; j < num_benchmarks; j++) {
+      selected.push_back(&benchmarks[j]);
+    }
+  }
+
+  /* Everything but db_parse itself needs the database and a world */
+  srand(seed);
+  db_parse(false);
+  world.seed = seed;
+  init_world();
+
+  fprintf(out, "{\n  \"seed\": %u,\n  \"unit\": \"ns\",\n"
+          "  \"benchmarks\": [", seed);
+  for (i = 0; i < (int) selected.size(); i++) {
+    run_benchmark(selected[i], seed, out, !i);
+  }
+  fprintf(out, "\n  ]\n}\n");
+
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  delete_world();
+
+  return 0;
+}
@@ -2,6 +2,8 @@
 
 #include "poke327.h"
 #include "io.h"
+#include "stats.h"
+#include "trace.h"
 
 /***********************************************************************
  * Hack: Avoid the "path to a building" issue by making building cells *
@@ -24,184 +26,189 @@ const char *char_type_name[num_character_types] = {
   "Trainer",
 };
 
-static void move_hiker_func(character *c, pair_t dest)
+const char *move_type_name[num_movement_types] = {
+  "move_hiker",
+  "move_rival",
+  "move_pace",
+  "move_wander",
+  "move_sentry",
+  "move_walk",
+  "move_pc",
+};
+
+static void move_hiker_func(map_t *m, int32_t i, pair_t dest)
 {
+  int16_t *pos = m->npcs.pos[i];
   int min;
   int base;
-  int i;
+  int j;
 
   base = rand() & 0x7;
 
-  dest[dim_x] = c->pos[dim_x];
-  dest[dim_y] = c->pos[dim_y];
+  dest[dim_x] = pos[dim_x];
+  dest[dim_y] = pos[dim_y];
   min = INT_MAX;
   
-  for (i = base; i < 8 + base; i++) {
-    if ((world.hiker_dist[c->pos[dim_y] + all_dirs[i & 0x7][dim_y]]
-                         [c->pos[dim_x] + all_dirs[i & 0x7][dim_x]] <=
+  for (j = base; j < 8 + base; j++) {
+    if ((world.hiker_dist[pos[dim_y] + all_dirs[j & 0x7][dim_y]]
+                         [pos[dim_x] + all_dirs[j & 0x7][dim_x]] <=
          min) &&
-        !world.cur_map->cmap[c->pos[dim_y] + all_dirs[i & 0x7][dim_y]]
-                            [c->pos[dim_x] + all_dirs[i & 0x7][dim_x]]) {
-      dest[dim_x] = c->pos[dim_x] + all_dirs[i & 0x7][dim_x];
-      dest[dim_y] = c->pos[dim_y] + all_dirs[i & 0x7][dim_y];
+        /* <= lets an unreachable (INT_MAX) cell win when nothing else does */
+        (world.hiker_dist[pos[dim_y] + all_dirs[j & 0x7][dim_y]]
+                         [pos[dim_x] + all_dirs[j & 0x7][dim_x]] !=
+         INT_MAX) &&
+        !map_occupied(m, pos[dim_y] + all_dirs[j & 0x7][dim_y],
+                      pos[dim_x] + all_dirs[j & 0x7][dim_x])) {
+      dest[dim_x] = pos[dim_x] + all_dirs[j & 0x7][dim_x];
+      dest[dim_y] = pos[dim_y] + all_dirs[j & 0x7][dim_y];
       min = world.hiker_dist[dest[dim_y]][dest[dim_x]];
     }
-    if (world.hiker_dist[c->pos[dim_y] + all_dirs[i & 0x7][dim_y]]
-                        [c->pos[dim_x] + all_dirs[i & 0x7][dim_x]] == 0) {
-      io_battle(c, &world.pc);
+    if (world.hiker_dist[pos[dim_y] + all_dirs[j & 0x7][dim_y]]
+                        [pos[dim_x] + all_dirs[j & 0x7][dim_x]] == 0) {
+      io_battle(m->trainer[i], &world.pc);
       break;
     }
   }
 }
 
-static void move_rival_func(character *c, pair_t dest)
+static void move_rival_func(map_t *m, int32_t i, pair_t dest)
 {
+  int16_t *pos = m->npcs.pos[i];
   int min;
   int base;
-  int i;
+  int j;
   
   base = rand() & 0x7;
 
-  dest[dim_x] = c->pos[dim_x];
-  dest[dim_y] = c->pos[dim_y];
+  dest[dim_x] = pos[dim_x];
+  dest[dim_y] = pos[dim_y];
   min = INT_MAX;
   
-  for (i = base; i < 8 + base; i++) {
-    if ((world.rival_dist[c->pos[dim_y] + all_dirs[i & 0x7][dim_y]]
-                         [c->pos[dim_x] + all_dirs[i & 0x7][dim_x]] <
+  for (j = base; j < 8 + base; j++) {
+    if ((world.rival_dist[pos[dim_y] + all_dirs[j & 0x7][dim_y]]
+                         [pos[dim_x] + all_dirs[j & 0x7][dim_x]] <
          min) &&
-        !world.cur_map->cmap[c->pos[dim_y] + all_dirs[i & 0x7][dim_y]]
-                            [c->pos[dim_x] + all_dirs[i & 0x7][dim_x]]) {
-      dest[dim_x] = c->pos[dim_x] + all_dirs[i & 0x7][dim_x];
-      dest[dim_y] = c->pos[dim_y] + all_dirs[i & 0x7][dim_y];
+        !map_occupied(m, pos[dim_y] + all_dirs[j & 0x7][dim_y],
+                      pos[dim_x] + all_dirs[j & 0x7][dim_x])) {
+      dest[dim_x] = pos[dim_x] + all_dirs[j & 0x7][dim_x];
+      dest[dim_y] = pos[dim_y] + all_dirs[j & 0x7][dim_y];
       min = world.rival_dist[dest[dim_y]][dest[dim_x]];
     }
-    if (world.rival_dist[c->pos[dim_y] + all_dirs[i & 0x7][dim_y]]
-                        [c->pos[dim_x] + all_dirs[i & 0x7][dim_x]] == 0) {
-      io_battle(c, &world.pc);
+    if (world.rival_dist[pos[dim_y] + all_dirs[j & 0x7][dim_y]]
+                        [pos[dim_x] + all_dirs[j & 0x7][dim_x]] == 0) {
+      io_battle(m->trainer[i], &world.pc);
       break;
     }
   }
 }
 
-static void move_pacer_func(character *c, pair_t dest)
+static void move_pacer_func(map_t *m, int32_t i, pair_t dest)
 {
-  npc *n = (npc *) c;
+  int16_t *pos = m->npcs.pos[i];
+  int16_t *dir = m->npcs.dir[i];
   
-  dest[dim_x] = n->pos[dim_x];
-  dest[dim_y] = n->pos[dim_y];
+  dest[dim_x] = pos[dim_x];
+  dest[dim_y] = pos[dim_y];
 
-  if (!n->defeated &&
-      world.cur_map->cmap[n->pos[dim_y] + n->dir[dim_y]]
-                         [n->pos[dim_x] + n->dir[dim_x]] ==
+  if (!m->npcs.defeated[i] &&
+      m->cmap[pos[dim_y] + dir[dim_y]][pos[dim_x] + dir[dim_x]] ==
       &world.pc) {
-      io_battle(c, &world.pc);
+      io_battle(m->trainer[i], &world.pc);
       return;
   }
 
-  if ((world.cur_map->map[n->pos[dim_y] + n->dir[dim_y]]
-                         [n->pos[dim_x] + n->dir[dim_x]] !=
-       world.cur_map->map[n->pos[dim_y]][n->pos[dim_x]]) ||
-      world.cur_map->cmap[n->pos[dim_y] + n->dir[dim_y]]
-                         [n->pos[dim_x] + n->dir[dim_x]]) {
-    n->dir[dim_x] *= -1;
-    n->dir[dim_y] *= -1;
+  if ((m->map[pos[dim_y] + dir[dim_y]][pos[dim_x] + dir[dim_x]] !=
+       m->map[pos[dim_y]][pos[dim_x]]) ||
+      map_occupied(m, pos[dim_y] + dir[dim_y], pos[dim_x] + dir[dim_x])) {
+    dir[dim_x] *= -1;
+    dir[dim_y] *= -1;
   }
 
-  if ((world.cur_map->map[n->pos[dim_y] + n->dir[dim_y]]
-                         [n->pos[dim_x] + n->dir[dim_x]] ==
-       world.cur_map->map[n->pos[dim_y]][n->pos[dim_x]]) &&
-      !world.cur_map->cmap[n->pos[dim_y] + n->dir[dim_y]]
-                          [n->pos[dim_x] + n->dir[dim_x]]) {
-    dest[dim_x] = n->pos[dim_x] + n->dir[dim_x];
-    dest[dim_y] = n->pos[dim_y] + n->dir[dim_y];
+  if ((m->map[pos[dim_y] + dir[dim_y]][pos[dim_x] + dir[dim_x]] ==
+       m->map[pos[dim_y]][pos[dim_x]]) &&
+      !map_occupied(m, pos[dim_y] + dir[dim_y], pos[dim_x] + dir[dim_x])) {
+    dest[dim_x] = pos[dim_x] + dir[dim_x];
+    dest[dim_y] = pos[dim_y] + dir[dim_y];
   }
 }
 
-static void move_wanderer_func(character *c, pair_t dest)
+static void move_wanderer_func(map_t *m, int32_t i, pair_t dest)
 {
-  npc *n = (npc *) c;
+  int16_t *pos = m->npcs.pos[i];
+  int16_t *dir = m->npcs.dir[i];
 
-  dest[dim_x] = n->pos[dim_x];
-  dest[dim_y] = n->pos[dim_y];
+  dest[dim_x] = pos[dim_x];
+  dest[dim_y] = pos[dim_y];
 
-  if (!n->defeated &&
-      world.cur_map->cmap[n->pos[dim_y] + n->dir[dim_y]]
-                         [n->pos[dim_x] + n->dir[dim_x]] ==
+  if (!m->npcs.defeated[i] &&
+      m->cmap[pos[dim_y] + dir[dim_y]][pos[dim_x] + dir[dim_x]] ==
       &world.pc) {
-      io_battle(c, &world.pc);
+      io_battle(m->trainer[i], &world.pc);
       return;
   }
 
-  if ((world.cur_map->map[n->pos[dim_y] + n->dir[dim_y]]
-                         [n->pos[dim_x] + n->dir[dim_x]] !=
-       world.cur_map->map[n->pos[dim_y]][n->pos[dim_x]]) ||
-      world.cur_map->cmap[n->pos[dim_y] + n->dir[dim_y]]
-                         [n->pos[dim_x] + n->dir[dim_x]]) {
-    rand_dir(n->dir);
+  if ((m->map[pos[dim_y] + dir[dim_y]][pos[dim_x] + dir[dim_x]] !=
+       m->map[pos[dim_y]][pos[dim_x]]) ||
+      map_occupied(m, pos[dim_y] + dir[dim_y], pos[dim_x] + dir[dim_x])) {
+    rand_dir(dir);
   }
 
-  if ((world.cur_map->map[n->pos[dim_y] + n->dir[dim_y]]
-                         [n->pos[dim_x] + n->dir[dim_x]] ==
-       world.cur_map->map[n->pos[dim_y]][n->pos[dim_x]]) &&
-      !world.cur_map->cmap[n->pos[dim_y] + n->dir[dim_y]]
-                          [n->pos[dim_x] + n->dir[dim_x]]) {
-    dest[dim_x] = n->pos[dim_x] + n->dir[dim_x];
-    dest[dim_y] = n->pos[dim_y] + n->dir[dim_y];
+  if ((m->map[pos[dim_y] + dir[dim_y]][pos[dim_x] + dir[dim_x]] ==
+       m->map[pos[dim_y]][pos[dim_x]]) &&
+      !map_occupied(m, pos[dim_y] + dir[dim_y], pos[dim_x] + dir[dim_x])) {
+    dest[dim_x] = pos[dim_x] + dir[dim_x];
+    dest[dim_y] = pos[dim_y] + dir[dim_y];
   }
 }
 
-static void move_sentry_func(character *c, pair_t dest)
+static void move_sentry_func(map_t *m, int32_t i, pair_t dest)
 {
+  int16_t *pos = m->npcs.pos[i];
+
   // Not a bug.  Sentries are non-aggro.
-  dest[dim_x] = c->pos[dim_x];
-  dest[dim_y] = c->pos[dim_y];
+  dest[dim_x] = pos[dim_x];
+  dest[dim_y] = pos[dim_y];
 }
 
-static void move_walker_func(character *c, pair_t dest)
+static void move_walker_func(map_t *m, int32_t i, pair_t dest)
 {
-  npc *n = (npc *) c;
+  int16_t *pos = m->npcs.pos[i];
+  int16_t *dir = m->npcs.dir[i];
 
-  dest[dim_x] = n->pos[dim_x];
-  dest[dim_y] = n->pos[dim_y];
+  dest[dim_x] = pos[dim_x];
+  dest[dim_y] = pos[dim_y];
 
-  if (!n->defeated &&
-      world.cur_map->cmap[n->pos[dim_y] + n->dir[dim_y]]
-                         [n->pos[dim_x] + n->dir[dim_x]] ==
+  if (!m->npcs.defeated[i] &&
+      m->cmap[pos[dim_y] + dir[dim_y]][pos[dim_x] + dir[dim_x]] ==
       &world.pc) {
-      io_battle(c, &world.pc);
+      io_battle(m->trainer[i], &world.pc);
       return;
   }
 
-  if ((move_cost[char_other][world.cur_map->map[n->pos[dim_y] +
-                                                n->dir[dim_y]]
-                                               [n->pos[dim_x] +
-                                                n->dir[dim_x]]] ==
-       INT_MAX) || world.cur_map->cmap[n->pos[dim_y] + n->dir[dim_y]]
-                                      [n->pos[dim_x] + n->dir[dim_x]]) {
-    n->dir[dim_x] *= -1;
-    n->dir[dim_y] *= -1;
+  if ((move_cost[char_other][m->map[pos[dim_y] + dir[dim_y]]
+                                   [pos[dim_x] + dir[dim_x]]] ==
+       INT_MAX) || map_occupied(m, pos[dim_y] + dir[dim_y],
+                                pos[dim_x] + dir[dim_x])) {
+    dir[dim_x] *= -1;
+    dir[dim_y] *= -1;
   }
 
-  if ((move_cost[char_other][world.cur_map->map[n->pos[dim_y] +
-                                                n->dir[dim_y]]
-                                               [n->pos[dim_x] +
-                                                n->dir[dim_x]]] !=
+  if ((move_cost[char_other][m->map[pos[dim_y] + dir[dim_y]]
+                                   [pos[dim_x] + dir[dim_x]]] !=
        INT_MAX) &&
-      !world.cur_map->cmap[n->pos[dim_y] + n->dir[dim_y]]
-                          [n->pos[dim_x] + n->dir[dim_x]]) {
-    dest[dim_x] = n->pos[dim_x] + n->dir[dim_x];
-    dest[dim_y] = n->pos[dim_y] + n->dir[dim_y];
+      !map_occupied(m, pos[dim_y] + dir[dim_y], pos[dim_x] + dir[dim_x])) {
+    dest[dim_x] = pos[dim_x] + dir[dim_x];
+    dest[dim_y] = pos[dim_y] + dir[dim_y];
   }
 }
 
-static void move_pc_func(character *c, pair_t dest)
+static void move_pc_func(map_t *m, int32_t i, pair_t dest)
 {
   io_display();
   io_handle_input(dest);
 }
 
-void (*move_func[num_movement_types])(character *, pair_t) = {
+void (*move_func[num_movement_types])(map_t *, int32_t, pair_t) = {
   move_hiker_func,
   move_rival_func,
   move_pacer_func,
@@ -211,11 +218,6 @@ void (*move_func[num_movement_types])(character *, pair_t) = {
   move_pc_func,
 };
 
-int32_t cmp_char_turns(const void *key, const void *with)
-{
-  return ((character *) key)->next_turn - ((character *) with)->next_turn;
-}
-
 void delete_character(void *v)
 {
   if (v != &world.pc) {
@@ -245,6 +247,8 @@ void pathfind(map_t *m)
   uint32_t x, y;
   static path_t p[MAP_Y][MAP_X], *c;
   static uint32_t initialized = 0;
+  stats_timer timer(stats_pathfind);
+  trace_scope trace("pathfind", "map");
 
   if (!initialized) {
     initialized = 1;
@@ -278,6 +282,10 @@ void pathfind(map_t *m)
 
   while ((c = (path_t *) heap_remove_min(&h))) {
     c->hn = NULL;
+    if (world.hiker_dist[c->pos[dim_y]][c->pos[dim_x]] == INT_MAX) {
+      /* Unreachable; adding a cost to INT_MAX would overflow */
+      continue;
+    }
     if ((p[c->pos[dim_y] - 1][c->pos[dim_x] - 1].hn) &&
         (world.hiker_dist[c->pos[dim_y] - 1][c->pos[dim_x] - 1] >
          world.hiker_dist[c->pos[dim_y]][c->pos[dim_x]] +
@@ -375,6 +383,10 @@ void pathfind(map_t *m)
 
   while ((c = (path_t *) heap_remove_min(&h))) {
     c->hn = NULL;
+    if (world.rival_dist[c->pos[dim_y]][c->pos[dim_x]] == INT_MAX) {
+      /* Unreachable; adding a cost to INT_MAX would overflow */
+      continue;
+    }
     if ((p[c->pos[dim_y] - 1][c->pos[dim_x] - 1].hn) &&
         (world.rival_dist[c->pos[dim_y] - 1][c->pos[dim_x] - 1] >
          world.rival_dist[c->pos[dim_y]][c->pos[dim_x]] +
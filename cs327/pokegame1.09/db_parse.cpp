@@ -1,515 +1,1154 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <cstddef>
 #include <sys/stat.h>
 #include <climits>
+#include <pthread.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 
 #include "db_parse.h"
+#include "trace.h"
 
-static char *next_token(char *start, char delim)
+const pokemon_move_columns *pokemon_moves;
+const pokemon_db *pokemondb;
+const char *types[19];
+const move_db *moves;
+pokemon_species_db *species;
+const experience_db *experience;
+const pokemon_stat_columns *pokemon_stats;
+const stats_db *stats;
+const pokemon_type_columns *pokemon_types;
+const int (*type_efficacy)[19];
+
+/* How a CSV column is kept */
+typedef enum db_kind {
+  db_int,               /* An int, 0 if blank */
+  db_null_int,          /* An int, INT_MAX if blank */
+  db_string,            /* A char array, "" if blank */
+  db_u8,                /* A column of uint8_t, DB_BLANK8 if blank */
+  db_u16                /* A column of uint16_t, DB_BLANK16 if blank */
+} db_kind_t;
+
+typedef struct db_field {
+  const char *name;     /* Its column's heading in the CSV */
+  db_kind_t kind;
+  int offset;           /* In the row, for a row table */
+  int size;             /* Of a string, its nul included */
+} db_field_t;
+
+/* A table is either rows, an array of structs of row_size, or columns, *
+ * in which case every field is a db_u8 or db_u16 and the columns are   *
+ * one after another, in field order.  Columns in the CSV are matched   *
+ * to fields by heading, so it can have them in any order, and others   *
+ * besides.                                                             */
+typedef struct db_schema {
+  const char *file;
+  const db_field_t *fields;
+  int num_fields;
+  int row_size;         /* 0 for a column table */
+  int key;              /* Field holding the id, or -1.  Column tables */
+                        /* are sorted by it.                           */
+  const char *filter;   /* If set, only rows with filter_value in this */
+  int filter_value;     /* column are kept (row tables only).          */
+} db_schema_t;
+
+#define DB_INT(s, f)      { #f, db_int, (int) offsetof(s, f), 0 }
+#define DB_NULL_INT(s, f) { #f, db_null_int, (int) offsetof(s, f), 0 }
+#define DB_STRING(s, f)   { #f, db_string, (int) offsetof(s, f),           \
+                            (int) sizeof (((s *) 0)->f) }
+#define DB_COLUMN(f, k)   { #f, k, 0, 0 }
+#define DB_FIELDS(a)      a, (int) (sizeof (a) / sizeof (a[0]))
+
+static const db_field_t db_pokemon_fields[] = {
+  DB_INT(pokemon_db, id),
+  DB_STRING(pokemon_db, identifier),
+  DB_INT(pokemon_db, species_id),
+  DB_INT(pokemon_db, height),
+  DB_INT(pokemon_db, weight),
+  DB_INT(pokemon_db, base_experience),
+  DB_INT(pokemon_db, order),
+  DB_INT(pokemon_db, is_default),
+};
+
+static const db_field_t db_moves_fields[] = {
+  DB_INT(move_db, id),
+  DB_STRING(move_db, identifier),
+  DB_NULL_INT(move_db, generation_id),
+  DB_NULL_INT(move_db, type_id),
+  DB_NULL_INT(move_db, power),
+  DB_NULL_INT(move_db, pp),
+  DB_NULL_INT(move_db, accuracy),
+  DB_NULL_INT(move_db, priority),
+  DB_NULL_INT(move_db, target_id),
+  DB_NULL_INT(move_db, damage_class_id),
+  DB_NULL_INT(move_db, effect_id),
+  DB_NULL_INT(move_db, effect_chance),
+  DB_NULL_INT(move_db, contest_type_id),
+  DB_NULL_INT(move_db, contest_effect_id),
+  DB_NULL_INT(move_db, super_contest_effect_id),
+};
+
+static const db_field_t db_pokemon_moves_fields[] = {
+  DB_COLUMN(pokemon_id, db_u16),
+  DB_COLUMN(version_group_id, db_u8),
+  DB_COLUMN(move_id, db_u16),
+  DB_COLUMN(pokemon_move_method_id, db_u8),
+  DB_COLUMN(level, db_u8),
+  DB_COLUMN(order, db_u8),
+};
+
+static const db_field_t db_pokemon_species_fields[] = {
+  DB_INT(pokemon_species_row, id),
+  DB_STRING(pokemon_species_row, identifier),
+  DB_NULL_INT(pokemon_species_row, generation_id),
+  DB_NULL_INT(pokemon_species_row, evolves_from_species_id),
+  DB_NULL_INT(pokemon_species_row, evolution_chain_id),
+  DB_NULL_INT(pokemon_species_row, color_id),
+  DB_NULL_INT(pokemon_species_row, shape_id),
+  DB_NULL_INT(pokemon_species_row, habitat_id),
+  DB_NULL_INT(pokemon_species_row, gender_rate),
+  DB_NULL_INT(pokemon_species_row, capture_rate),
+  DB_NULL_INT(pokemon_species_row, base_happiness),
+  DB_NULL_INT(pokemon_species_row, is_baby),
+  DB_NULL_INT(pokemon_species_row, hatch_counter),
+  DB_NULL_INT(pokemon_species_row, has_gender_differences),
+  DB_NULL_INT(pokemon_species_row, growth_rate_id),
+  DB_NULL_INT(pokemon_species_row, forms_switchable),
+  DB_NULL_INT(pokemon_species_row, is_legendary),
+  DB_NULL_INT(pokemon_species_row, is_mythical),
+  DB_NULL_INT(pokemon_species_row, order),
+  DB_NULL_INT(pokemon_species_row, conquest_order),
+};
+
+static const db_field_t db_experience_fields[] = {
+  DB_INT(experience_db, growth_rate_id),
+  DB_NULL_INT(experience_db, level),
+  DB_NULL_INT(experience_db, experience),
+};
+
+static const db_field_t db_type_names_fields[] = {
+  DB_INT(type_names_db, type_id),
+  DB_INT(type_names_db, local_language_id),
+  DB_STRING(type_names_db, name),
+};
+
+static const db_field_t db_pokemon_stats_fields[] = {
+  DB_COLUMN(pokemon_id, db_u16),
+  DB_COLUMN(stat_id, db_u8),
+  DB_COLUMN(base_stat, db_u16),
+  DB_COLUMN(effort, db_u8),
+};
+
+static const db_field_t db_stats_fields[] = {
+  DB_INT(stats_db, id),
+  DB_NULL_INT(stats_db, damage_class_id),
+  DB_STRING(stats_db, identifier),
+  DB_NULL_INT(stats_db, is_battle_only),
+  DB_NULL_INT(stats_db, game_index),
+};
+
+static const db_field_t db_pokemon_types_fields[] = {
+  DB_COLUMN(pokemon_id, db_u16),
+  DB_COLUMN(type_id, db_u8),
+  DB_COLUMN(slot, db_u8),
+};
+
+static const db_field_t db_type_efficacy_fields[] = {
+  DB_INT(type_efficacy_db, damage_type_id),
+  DB_INT(type_efficacy_db, target_type_id),
+  DB_INT(type_efficacy_db, damage_factor),
+};
+
+/* In db_table_t order */
+static const db_schema_t db_schemas[num_db_tables] = {
+  { "pokemon.csv", DB_FIELDS(db_pokemon_fields),
+    sizeof (pokemon_db), 0, NULL, 0 },
+  { "moves.csv", DB_FIELDS(db_moves_fields),
+    sizeof (move_db), 0, NULL, 0 },
+  { "pokemon_moves.csv", DB_FIELDS(db_pokemon_moves_fields),
+    0, 0, NULL, 0 },
+  { "pokemon_species.csv", DB_FIELDS(db_pokemon_species_fields),
+    sizeof (pokemon_species_row), 0, NULL, 0 },
+  { "experience.csv", DB_FIELDS(db_experience_fields),
+    sizeof (experience_db), -1, NULL, 0 },
+  /* Just the English names */
+  { "type_names.csv", DB_FIELDS(db_type_names_fields),
+    sizeof (type_names_db), 0, "local_language_id", 9 },
+  { "pokemon_stats.csv", DB_FIELDS(db_pokemon_stats_fields),
+    0, 0, NULL, 0 },
+  { "stats.csv", DB_FIELDS(db_stats_fields),
+    sizeof (stats_db), 0, NULL, 0 },
+  { "pokemon_types.csv", DB_FIELDS(db_pokemon_types_fields),
+    0, 0, NULL, 0 },
+  { "type_efficacy.csv", DB_FIELDS(db_type_efficacy_fields),
+    sizeof (type_efficacy_db), -1, NULL, 0 },
+};
+
+/* Everything in the block starts on an 8 byte boundary */
+#define DB_ALIGN(n) (((n) + 7) & ~(uint64_t) 7)
+
+static int db_width(db_kind_t kind)
+{
+  return kind == db_u8 ? 1 : 2;
+}
+
+/* Where field's column of a column table starts, or the rows of a row *
+ * table (for any field).                                              */
+static const char *db_column(const db_tables *t, db_table_t table, int field)
 {
+  const db_schema_t *s = db_schemas + table;
+  uint64_t offset;
   int i;
-  static char *s;
 
-  if (start) {
-    s = start;
+  offset = t->table[table].offset;
+  for (i = 0; !s->row_size && i < field; i++) {
+    offset += DB_ALIGN((uint64_t) db_width(s->fields[i].kind) *
+                       t->table[table].size);
   }
 
-  start = s;
+  return (const char *) t + offset;
+}
 
-  for (i = 0; s[i] && s[i] != delim; i++)
-    ;
-  s[i] = '\0';
-  s = s + i + 1;
+/* The indexes behind the lookups in db_parse.h, one set per version.  *
+ * The *_start vectors hold, for each id, the first row of the sorted  *
+ * table with that id or a bigger one, and one more entry for the row  *
+ * past the last id's, so id's rows run up to the next id's first.     */
+struct db_indexes {
+  std::vector<int> pokemon_by_id, move_by_id, species_by_id;
+  std::unordered_map<std::string, int> pokemon_by_name;
+  std::unordered_map<std::string, int> move_by_name;
+  std::unordered_map<std::string, int> species_by_name;
+  std::unordered_map<std::string, int> type_by_name;
+  std::vector<int> move_start, stat_start, type_start;
+  std::once_flag learners_built;
+  std::vector<int> learner_start;
+  std::vector<uint16_t> learners;
+};
+
+/* The version in use */
+static std::shared_ptr<db_version> db_active;
 
-  return start;
+int db_size(db_table_t table)
+{
+  return db_active ? (int) db_active->tables->table[table].size : 0;
 }
 
-/* We can't print a "null integer", so it takes an annoying amount of code *
- * to check for INT_MAX and then print "", otherwise print the integer     *
- * value.  This function converts ints to strings only if they do not have *
- * the value INT_MAX and returns the string, so no extra work needs to be  *
- * done where we print (except calling this function).                     *
- *                                                                         *
- * Needs an internal array because arguments are processed before the      *
- * function call, so if we returned the same pointer over and over again,  *
- * we'd print a bunch of whatever the final value processed was.           */
-static const char *i2s(int i)
+/* A row table's rows by its key and by its (first) string */
+static void db_index_table(const db_tables *t, db_table_t table,
+                           std::vector<int> &by_id,
+                           std::unordered_map<std::string, int> &by_name)
 {
-  static int next = 0;
-  static char s[20][12];
+  const db_schema_t *s = db_schemas + table;
+  const char *row;
+  int id, name, i;
+
+  for (name = 0; s->fields[name].kind != db_string; name++)
+    ;
 
-  if (next == 20) {
-    next = 0;
+  for (i = 1; i < (int) t->table[table].size; i++) {
+    row = db_column(t, table, 0) + (size_t) i * s->row_size;
+    memcpy(&id, row + s->fields[s->key].offset, sizeof (id));
+    if (id > 0 && id != INT_MAX) {
+      if ((int) by_id.size() <= id) {
+        by_id.resize(id + 1, 0);
+      }
+      by_id[id] = i;
+    }
+    /* The first of any duplicates wins, as a scan would have it */
+    by_name.emplace(row + s->fields[name].offset, i);
   }
-  
-  if (i == INT_MAX) {
-    s[next][0] = '\0';
-  } else {
-    sprintf(s[next], "%d", i);
+}
+
+/* Rows 1 to n - 1 of a table sorted by pokemon_id */
+static void db_index_column(const uint16_t *pokemon_id, int n,
+                            std::vector<int> &start)
+{
+  int id, max, i;
+
+  for (max = 0, i = 1; i < n; i++) {
+    if (pokemon_id[i] != DB_BLANK16 && pokemon_id[i] > max) {
+      max = pokemon_id[i];
+    }
   }
 
-  return s[next++];
+  start.resize(max + 2);
+  for (i = 1, id = 0; id <= max + 1; id++) {
+    while (i < n && pokemon_id[i] < id) {
+      i++;
+    }
+    start[id] = i;
+  }
 }
 
-pokemon_move_db pokemon_moves[528239];
-pokemon_db pokemondb[1093];
-char *types[19];
-move_db moves[845];
-pokemon_species_db species[899];
-experience_db experience[601];
-pokemon_stats_db pokemon_stats[6553];
-stats_db stats[9];
-pokemon_types_db pokemon_types[1676];
+/* Who learns what, from pokemon_moves.  Its rows are sorted by   *
+ * pokemon_id, so a pokemon's rows for a move are never split up  *
+ * by another pokemon's, and each list comes out sorted.  This    *
+ * one reads all of the move_id column, which costs more than     *
+ * the rest of the indexes together, so it waits until it's       *
+ * asked for, like a species' move list (pokemon.cpp), and runs   *
+ * once per version, under learners_built, whichever thread asks. */
+static void db_index_learners(db_version *v)
+{
+  const pokemon_move_columns *pm = &v->pokemon_moves;
+  const int n = v->tables->table[db_pokemon_moves_csv].size;
+  db_indexes *x = v->index;
+  std::vector<int> last, next;
+  int max, m, p, i;
 
-void db_parse(bool print)
+  for (max = 0, i = 1; i < n; i++) {
+    if (pm->move_id[i] != DB_BLANK16 && pm->move_id[i] > max) {
+      max = pm->move_id[i];
+    }
+  }
+
+  /* Count each move's learners, then fill the lists in */
+  x->learner_start.assign(max + 2, 0);
+  last.assign(max + 1, -1);
+  for (i = 1; i < n; i++) {
+    m = pm->move_id[i];
+    p = pm->pokemon_id[i];
+    if (m != DB_BLANK16 && p != DB_BLANK16 && last[m] != p) {
+      last[m] = p;
+      x->learner_start[m + 1]++;
+    }
+  }
+  for (m = 0; m <= max; m++) {
+    x->learner_start[m + 1] += x->learner_start[m];
+  }
+
+  x->learners.resize(x->learner_start[max + 1]);
+  next.assign(x->learner_start.begin(), x->learner_start.end() - 1);
+  last.assign(max + 1, -1);
+  for (i = 1; i < n; i++) {
+    m = pm->move_id[i];
+    p = pm->pokemon_id[i];
+    if (m != DB_BLANK16 && p != DB_BLANK16 && last[m] != p) {
+      last[m] = p;
+      x->learners[next[m]++] = p;
+    }
+  }
+}
+
+static void db_index(db_version *v)
 {
-  FILE *f;
-  char line[800];
+  const db_tables *t = v->tables;
+  db_indexes *x = v->index;
   int i;
-  char *tmp;
-  struct stat buf;
-  char *prefix;
-  int prefix_len;
-  int j;
-  int count;
-  
-  i = (strlen(getenv("HOME")) +
-       strlen("/.poke327/pokedex/pokedex/data/csv/") + 1);
-  prefix = (char *) malloc(i);
-  strcpy(prefix, getenv("HOME"));
-  strcat(prefix, "/.poke327/pokedex/pokedex/data/csv/");
-
-  if (stat(prefix, &buf)) {
-    free(prefix);
-    prefix = NULL;
-  }
-
-  if (!prefix && !stat("/share/cs327", &buf)) {
-    prefix = strdup("/share/cs327/pokedex/pokedex/data/csv/");
-  } else if (!prefix) {
-    // Your third location goes here, if needed.
-    // prefix is freed later, so be sure you malloc it
-  }
-
-  //No error checking on file load from here on out.  Missing
-  //files are "user error".
-  prefix_len = strlen(prefix);
-
-  prefix = (char *) realloc(prefix, prefix_len + strlen("pokemon.csv") + 1);
-  strcpy(prefix + prefix_len, "pokemon.csv");
-  
-  f = fopen(prefix, "r");
-
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
-
-  fgets(line, 80, f);
-  
-  for (i = 1; i < 1093; i++) {
-    fgets(line, 80, f);
-    pokemondb[i].id = atoi(next_token(line, ','));
-    strncpy(pokemondb[i].identifier, next_token(NULL, ','), 30);
-    pokemondb[i].species_id = atoi(next_token(NULL, ','));
-    pokemondb[i].height = atoi(next_token(NULL, ','));
-    pokemondb[i].weight = atoi(next_token(NULL, ','));
-    pokemondb[i].base_experience = atoi(next_token(NULL, ','));
-    pokemondb[i].order = atoi(next_token(NULL, ','));
-    pokemondb[i].is_default = atoi(next_token(NULL, ','));
-  }  
 
-  fclose(f);
-  
-  if (print) {
-    f = fopen("pokemon.csv", "w");
-    for (i = 1; i < 1093; i++) {
-      fprintf(f, "%s,%s,%s,%s,%s,%s,%s,%s\n",
-              i2s(pokemondb[i].id),
-              pokemondb[i].identifier,
-              i2s(pokemondb[i].species_id),
-              i2s(pokemondb[i].height),
-              i2s(pokemondb[i].weight),
-              i2s(pokemondb[i].base_experience),
-              i2s(pokemondb[i].order),
-              i2s(pokemondb[i].is_default));
+  db_index_table(t, db_pokemon_csv, x->pokemon_by_id, x->pokemon_by_name);
+  db_index_table(t, db_moves_csv, x->move_by_id, x->move_by_name);
+  db_index_table(t, db_pokemon_species_csv, x->species_by_id,
+                 x->species_by_name);
+  for (i = 1; i < 19; i++) {
+    if (*v->types[i]) {
+      x->type_by_name.emplace(v->types[i], i);
     }
-    fclose(f);
   }
 
+  db_index_column(v->pokemon_moves.pokemon_id,
+                  t->table[db_pokemon_moves_csv].size, x->move_start);
+  db_index_column(v->pokemon_stats.pokemon_id,
+                  t->table[db_pokemon_stats_csv].size, x->stat_start);
+  db_index_column(v->pokemon_types.pokemon_id,
+                  t->table[db_pokemon_types_csv].size, x->type_start);
+}
+
+static int db_lookup(const std::vector<int> &by_id, int id)
+{
+  return id > 0 && id < (int) by_id.size() ? by_id[id] : 0;
+}
+
+static int db_lookup(const std::unordered_map<std::string, int> &by_name,
+                     const char *identifier)
+{
+  std::unordered_map<std::string, int>::const_iterator it;
+
+  it = by_name.find(identifier);
+
+  return it == by_name.end() ? 0 : it->second;
+}
 
-  prefix = (char *) realloc(prefix, prefix_len + strlen("moves.csv") + 1);
-  strcpy(prefix + prefix_len, "moves.csv");
-  
-  f = fopen(prefix, "r");
-
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
-
-  fgets(line, 800, f);
-  
-  for (i = 1; i < 845; i++) {
-    fgets(line, 800, f);
-    moves[i].id = atoi((tmp = next_token(line, ',')));
-    strcpy(moves[i].identifier, (tmp = next_token(NULL, ',')));
-    tmp = next_token(NULL, ',');
-    moves[i].generation_id = *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    moves[i].type_id =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    moves[i].power =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    moves[i].pp =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    moves[i].accuracy =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    moves[i].priority =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    moves[i].target_id =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    moves[i].damage_class_id =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    moves[i].effect_id =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    moves[i].effect_chance =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    moves[i].contest_type_id =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    moves[i].contest_effect_id =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    moves[i].super_contest_effect_id = (*tmp != '\n') ? atoi(tmp) : INT_MAX;
+static db_range db_rows(const std::vector<int> &start, int pokemon_id)
+{
+  if (pokemon_id <= 0 || pokemon_id + 1 >= (int) start.size()) {
+    return { 0, 0 };
   }
 
-  fclose(f);
-  
-  if (print) {
-    f = fopen("moves.csv", "w");
-    for (i = 1; i < 845; i++) {
-      fprintf(f, "%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n",
-              i2s(moves[i].id),
-              moves[i].identifier,
-              i2s(moves[i].generation_id),
-              i2s(moves[i].type_id),
-              i2s(moves[i].power),
-              i2s(moves[i].pp),
-              i2s(moves[i].accuracy),
-              i2s(moves[i].priority),
-              i2s(moves[i].target_id),
-              i2s(moves[i].damage_class_id),
-              i2s(moves[i].effect_id),
-              i2s(moves[i].effect_chance),
-              i2s(moves[i].contest_type_id),
-              i2s(moves[i].contest_effect_id),
-              i2s(moves[i].super_contest_effect_id));
+  return { start[pokemon_id], start[pokemon_id + 1] };
+}
+
+int db_pokemon_row(int id)
+{
+  return db_lookup(db_active->index->pokemon_by_id, id);
+}
+
+int db_move_row(int id)
+{
+  return db_lookup(db_active->index->move_by_id, id);
+}
+
+int db_species_row(int id)
+{
+  return db_lookup(db_active->index->species_by_id, id);
+}
+
+int db_find_pokemon(const char *identifier)
+{
+  return db_lookup(db_active->index->pokemon_by_name, identifier);
+}
+
+int db_find_move(const char *identifier)
+{
+  return db_lookup(db_active->index->move_by_name, identifier);
+}
+
+int db_find_species(const char *identifier)
+{
+  return db_lookup(db_active->index->species_by_name, identifier);
+}
+
+int db_find_type(const char *identifier)
+{
+  return db_lookup(db_active->index->type_by_name, identifier);
+}
+
+db_range db_pokemon_move_rows(int pokemon_id)
+{
+  return db_rows(db_active->index->move_start, pokemon_id);
+}
+
+db_range db_pokemon_stat_rows(int pokemon_id)
+{
+  return db_rows(db_active->index->stat_start, pokemon_id);
+}
+
+db_range db_pokemon_type_rows(int pokemon_id)
+{
+  return db_rows(db_active->index->type_start, pokemon_id);
+}
+
+int db_move_learners(int move_id, const uint16_t **pokemon_ids)
+{
+  db_version *v = db_active.get();
+  db_indexes *x = v->index;
+
+  std::call_once(x->learners_built, db_index_learners, v);
+  if (move_id <= 0 || move_id + 1 >= (int) x->learner_start.size()) {
+    *pokemon_ids = NULL;
+    return 0;
+  }
+
+  *pokemon_ids = x->learners.data() + x->learner_start[move_id];
+
+  return x->learner_start[move_id + 1] - x->learner_start[move_id];
+}
+
+db_version::db_version(const db_tables *t, db_tables *block) :
+  tables(t), owned(block), species(), index(new db_indexes)
+{
+  const pokemon_species_row *rows;
+  const type_names_db *names;
+  const type_efficacy_db *e;
+  int i, j;
+
+  pokemondb = (const pokemon_db *) db_column(t, db_pokemon_csv, 0);
+  moves = (const move_db *) db_column(t, db_moves_csv, 0);
+  experience = (const experience_db *) db_column(t, db_experience_csv, 0);
+  stats = (const stats_db *) db_column(t, db_stats_csv, 0);
+
+  pokemon_moves.pokemon_id =
+    (const uint16_t *) db_column(t, db_pokemon_moves_csv, 0);
+  pokemon_moves.version_group_id =
+    (const uint8_t *) db_column(t, db_pokemon_moves_csv, 1);
+  pokemon_moves.move_id =
+    (const uint16_t *) db_column(t, db_pokemon_moves_csv, 2);
+  pokemon_moves.pokemon_move_method_id =
+    (const uint8_t *) db_column(t, db_pokemon_moves_csv, 3);
+  pokemon_moves.level =
+    (const uint8_t *) db_column(t, db_pokemon_moves_csv, 4);
+  pokemon_moves.order =
+    (const uint8_t *) db_column(t, db_pokemon_moves_csv, 5);
+
+  pokemon_stats.pokemon_id =
+    (const uint16_t *) db_column(t, db_pokemon_stats_csv, 0);
+  pokemon_stats.stat_id =
+    (const uint8_t *) db_column(t, db_pokemon_stats_csv, 1);
+  pokemon_stats.base_stat =
+    (const uint16_t *) db_column(t, db_pokemon_stats_csv, 2);
+  pokemon_stats.effort =
+    (const uint8_t *) db_column(t, db_pokemon_stats_csv, 3);
+
+  pokemon_types.pokemon_id =
+    (const uint16_t *) db_column(t, db_pokemon_types_csv, 0);
+  pokemon_types.type_id =
+    (const uint8_t *) db_column(t, db_pokemon_types_csv, 1);
+  pokemon_types.slot =
+    (const uint8_t *) db_column(t, db_pokemon_types_csv, 2);
+
+  /* Types past the 18 the game knows are left out */
+  names = (const type_names_db *) db_column(t, db_type_names_csv, 0);
+  for (i = 0; i < 19; i++) {
+    types[i] = "";
+  }
+  for (i = 1; i < (int) t->table[db_type_names_csv].size; i++) {
+    if (names[i].type_id > 0 && names[i].type_id < 19) {
+      types[names[i].type_id] = names[i].name;
     }
-    fclose(f);
   }
 
-  prefix = (char *) realloc(prefix,
-                            prefix_len + strlen("pokemon_moves.csv") + 1);
-  strcpy(prefix + prefix_len, "pokemon_moves.csv");
-  
-  f = fopen(prefix, "r");
-
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
-
-  fgets(line, 800, f);
-  
-  for (i = 1; i < 528239; i++) {
-    fgets(line, 800, f);
-    tmp = next_token(line, ',');
-    pokemon_moves[i].pokemon_id = *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    pokemon_moves[i].version_group_id = *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    pokemon_moves[i].move_id = *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    pokemon_moves[i].pokemon_move_method_id = *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    pokemon_moves[i].level = *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    pokemon_moves[i].order = (*tmp != '\n') ? atoi(tmp) : INT_MAX;
+  e = (const type_efficacy_db *) db_column(t, db_type_efficacy_csv, 0);
+  for (i = 0; i < 19; i++) {
+    for (j = 0; j < 19; j++) {
+      type_efficacy[i][j] = 100;
+    }
+  }
+  for (i = 1; i < (int) t->table[db_type_efficacy_csv].size; i++) {
+    if (e[i].damage_type_id > 0 && e[i].damage_type_id < 19 &&
+        e[i].target_type_id > 0 && e[i].target_type_id < 19) {
+      type_efficacy[e[i].damage_type_id][e[i].target_type_id] =
+        e[i].damage_factor;
+    }
   }
 
-  fclose(f);
+  rows = ((const pokemon_species_row *)
+          db_column(t, db_pokemon_species_csv, 0));
+  species.resize(t->table[db_pokemon_species_csv].size);
+  for (i = 0; i < (int) species.size(); i++) {
+    static_cast<pokemon_species_row &>(species[i]) = rows[i];
+  }
+
+  db_index(this);
+}
+
+db_version::~db_version()
+{
+  delete index;
+  free(owned);
+}
+
+std::shared_ptr<db_version> db_current(void)
+{
+  return db_active;
+}
+
+void db_use_version(db_version *v)
+{
+  db_active.reset(v);
+
+  pokemondb = v->pokemondb;
+  moves = v->moves;
+  species = v->species.data();
+  experience = v->experience;
+  stats = v->stats;
+  pokemon_moves = &v->pokemon_moves;
+  pokemon_stats = &v->pokemon_stats;
+  pokemon_types = &v->pokemon_types;
+  memcpy(types, v->types, sizeof (types));
+  type_efficacy = v->type_efficacy;
+}
+
+void db_use(const db_tables *t)
+{
+  db_use_version(new db_version(t, NULL));
+}
+
+static int db_widen(int v, int blank)
+{
+  return v == blank ? INT_MAX : v;
+}
+
+pokemon_move_db db_pokemon_move(int i)
+{
+  pokemon_move_db m;
+
+  m.pokemon_id = db_widen(pokemon_moves->pokemon_id[i], DB_BLANK16);
+  m.version_group_id = db_widen(pokemon_moves->version_group_id[i],
+                                DB_BLANK8);
+  m.move_id = db_widen(pokemon_moves->move_id[i], DB_BLANK16);
+  m.pokemon_move_method_id =
+    db_widen(pokemon_moves->pokemon_move_method_id[i], DB_BLANK8);
+  m.level = db_widen(pokemon_moves->level[i], DB_BLANK8);
+  m.order = db_widen(pokemon_moves->order[i], DB_BLANK8);
+
+  return m;
+}
+
+pokemon_stats_db db_pokemon_stat(int i)
+{
+  pokemon_stats_db s;
+
+  s.pokemon_id = db_widen(pokemon_stats->pokemon_id[i], DB_BLANK16);
+  s.stat_id = db_widen(pokemon_stats->stat_id[i], DB_BLANK8);
+  s.base_stat = db_widen(pokemon_stats->base_stat[i], DB_BLANK16);
+  s.effort = db_widen(pokemon_stats->effort[i], DB_BLANK8);
+
+  return s;
+}
+
+pokemon_types_db db_pokemon_type(int i)
+{
+  pokemon_types_db p;
+
+  p.pokemon_id = db_widen(pokemon_types->pokemon_id[i], DB_BLANK16);
+  p.type_id = db_widen(pokemon_types->type_id[i], DB_BLANK8);
+  p.slot = db_widen(pokemon_types->slot[i], DB_BLANK8);
+
+  return p;
+}
+
+#ifdef DB_EMBED
+
+/* The block is in db_embed.cpp, already in its final form */
+void db_parse(bool print)
+{
+  db_use((const db_tables *) db_embedded);
+}
+
+void db_parse_threads(int n)
+{
+}
+
+#else
+
+/* Bytes table takes up with size rows */
+static uint64_t db_table_bytes(db_table_t table, uint32_t size)
+{
+  const db_schema_t *s = db_schemas + table;
+  uint64_t n;
+  int i;
+
+  if (s->row_size) {
+    return DB_ALIGN((uint64_t) s->row_size * size);
+  }
+
+  for (n = 0, i = 0; i < s->num_fields; i++) {
+    n += DB_ALIGN((uint64_t) db_width(s->fields[i].kind) * size);
+  }
+
+  return n;
+}
+
+/* A CSV is parsed in pieces of this many rows, so that threads can *
+ * share out a big one.                                             */
+#define DB_CHUNK_ROWS  65536
+/* Most columns a CSV can have, and fields a table */
+#define DB_MAX_COLUMNS 64
+
+/* One CSV on its way into the block */
+typedef struct db_load {
+  const db_schema_t *schema;
+  char *text;                   /* The whole file, nul-terminated */
+  char *body;                   /* Its first line after the headings */
+  int field[DB_MAX_COLUMNS];    /* The field each column is, or -1 */
+  int num_columns;
+  int filter;                   /* The column to filter on, or -1 */
+  uint32_t size;                /* Rows, the unused row 0 included */
+  char *data[DB_MAX_COLUMNS];   /* Where each field of row 0 goes, */
+  int stride[DB_MAX_COLUMNS];   /* and how far apart the rows are  */
+} db_load_t;
+
+/* Rows of a CSV for one thread to parse */
+typedef struct db_chunk {
+  db_load_t *load;
+  char *start, *end;
+  uint32_t row;                 /* Of its first line */
+  int line;                     /* In the file, for errors */
+} db_chunk_t;
+
+typedef struct db_work {
+  std::vector<db_chunk_t> chunks;
+  std::atomic<size_t> next;
+  std::atomic<int> failed;
+} db_work_t;
+
+static int db_threads = 1;
 
-  if (print) {
-    f = fopen("pokemon_moves.csv", "w");
-    for (i = 1; i < 528239; i++) {
-      fprintf(f, "%s,%s,%s,%s,%s,%s\n",
-              i2s(pokemon_moves[i].pokemon_id),
-              i2s(pokemon_moves[i].version_group_id),
-              i2s(pokemon_moves[i].move_id),
-              i2s(pokemon_moves[i].pokemon_move_method_id),
-              i2s(pokemon_moves[i].level),
-              i2s(pokemon_moves[i].order));
+void db_parse_threads(int n)
+{
+  db_threads = std::max(n, 1);
+}
+
+char *db_prefix(void)
+{
+  struct stat buf;
+  const char *home;
+  char *prefix;
+
+  if ((home = getenv("HOME"))) {
+    prefix = (char *) malloc(strlen(home) +
+                             strlen("/.poke327/pokedex/pokedex/data/csv/") + 1);
+    strcpy(prefix, home);
+    strcat(prefix, "/.poke327/pokedex/pokedex/data/csv/");
+    if (!stat(prefix, &buf)) {
+      return prefix;
     }
-    fclose(f);
+    free(prefix);
   }
 
-  prefix = (char *) realloc(prefix,
-                            prefix_len + strlen("pokemon_species.csv") + 1);
-  strcpy(prefix + prefix_len, "pokemon_species.csv");
-  
-  f = fopen(prefix, "r");
-
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
-
-  fgets(line, 800, f);
-  
-  for (i = 1; i < 899; i++) {
-    fgets(line, 800, f);
-    species[i].id = atoi((tmp = next_token(line, ',')));
-    strcpy(species[i].identifier, (tmp = next_token(NULL, ',')));
-    tmp = next_token(NULL, ',');
-    species[i].generation_id = *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].evolves_from_species_id =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].evolution_chain_id =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].color_id =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].shape_id =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].habitat_id =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].gender_rate =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].capture_rate =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].base_happiness =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].is_baby =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].hatch_counter =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].has_gender_differences =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].growth_rate_id =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].forms_switchable =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].is_legendary =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].is_mythical =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].order =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    species[i].conquest_order = (*tmp != '\n') ? atoi(tmp) : INT_MAX;
+  if (!stat("/share/cs327", &buf)) {
+    return strdup("/share/cs327/pokedex/pokedex/data/csv/");
   }
 
-  fclose(f);
+  // Your third location goes here, if needed.
+  // prefix is freed later, so be sure you malloc it
+
+  return NULL;
+}
+
+static char *db_line_end(char *p)
+{
+  char *e;
+
+  return (e = strchr(p, '\n')) ? e : p + strlen(p);
+}
+
+static bool db_blank_line(const char *p)
+{
+  return *p == '\n' || (*p == '\r' && p[1] == '\n');
+}
 
-  if (print) {
-    f = fopen("pokemon_species.csv", "w");
-    for (i = 1; i < 899; i++) {
-      fprintf(f,
-              "%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n",
-              i2s(species[i].id),
-              species[i].identifier,
-              i2s(species[i].generation_id),
-              i2s(species[i].evolves_from_species_id),
-              i2s(species[i].evolution_chain_id),
-              i2s(species[i].color_id),
-              i2s(species[i].shape_id),
-              i2s(species[i].habitat_id),
-              i2s(species[i].gender_rate),
-              i2s(species[i].capture_rate),
-              i2s(species[i].base_happiness),
-              i2s(species[i].is_baby),
-              i2s(species[i].hatch_counter),
-              i2s(species[i].has_gender_differences),
-              i2s(species[i].growth_rate_id),
-              i2s(species[i].forms_switchable),
-              i2s(species[i].is_legendary),
-              i2s(species[i].is_mythical),
-              i2s(species[i].order),
-              i2s(species[i].conquest_order));
+/* The field starting at s, ending at the next comma or end of line; *
+ * returns its end, and sets *next to what follows it.               */
+static char *db_next_field(char *s, char **next)
+{
+  char *p;
+
+  for (p = s; *p && *p != ',' && *p != '\n'; p++)
+    ;
+  *next = p;
+
+  return (p > s && p[-1] == '\r' && *p != ',') ? p - 1 : p;
+}
+
+/* Reads s up to e as a number; returns non-zero if it isn't one.  *
+ * INT_MAX stands for a blank, so it's as out of range as anything *
+ * bigger.                                                         */
+static int db_number(const char *s, const char *e, int *v)
+{
+  long long n;
+  bool negative;
+
+  if ((negative = (s < e && *s == '-'))) {
+    s++;
+  }
+  if (s == e) {
+    return 1;
+  }
+  for (n = 0; s < e; s++) {
+    if (*s < '0' || *s > '9' || (n = n * 10 + (*s - '0')) >= INT_MAX) {
+      return 1;
     }
-    fclose(f);
+  }
+  *v = (int) (negative ? -n : n);
+
+  return 0;
+}
+
+static int db_store(const db_load_t *l, int field, uint32_t row,
+                    const char *s, const char *e, int line)
+{
+  const db_field_t *f = l->schema->fields + field;
+  char *d = l->data[field] + (size_t) row * l->stride[field];
+  uint16_t u16;
+  int v;
+
+  if (f->kind == db_string) {
+    if (e - s >= f->size) {
+      fprintf(stderr, "%s line %d: %s \"%.*s\" is longer than %d\n",
+              l->schema->file, line, f->name, (int) (e - s), s, f->size - 1);
+      return 1;
+    }
+    memcpy(d, s, e - s);
+    d[e - s] = '\0';
+
+    return 0;
   }
 
+  if (s == e) {
+    v = (f->kind == db_int ? 0 : f->kind == db_null_int ? INT_MAX :
+         f->kind == db_u8 ? DB_BLANK8 : DB_BLANK16);
+  } else if (db_number(s, e, &v)) {
+    fprintf(stderr, "%s line %d: %s \"%.*s\" isn't a number\n",
+            l->schema->file, line, f->name, (int) (e - s), s);
+    return 1;
+  } else if ((f->kind == db_u8 && (v < 0 || v >= DB_BLANK8)) ||
+             (f->kind == db_u16 && (v < 0 || v >= DB_BLANK16))) {
+    /* A pokedex this build can't hold without wider columns */
+    fprintf(stderr, "%s line %d: %s %d doesn't fit in its column\n",
+            l->schema->file, line, f->name, v);
+    return 1;
+  }
 
-  prefix = (char *) realloc(prefix, prefix_len + strlen("experience.csv") + 1);
-  strcpy(prefix + prefix_len, "experience.csv");
-  
-  f = fopen(prefix, "r");
+  switch (f->kind) {
+  case db_u8:
+    *(uint8_t *) d = v;
+    break;
+  case db_u16:
+    u16 = v;
+    memcpy(d, &u16, sizeof (u16));
+    break;
+  default:
+    memcpy(d, &v, sizeof (v));
+    break;
+  }
 
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
+  return 0;
+}
+
+/* A field of a row, as its CSV has it (INT_MAX for a blank) */
+static int db_get(const db_load_t *l, int field, uint32_t row)
+{
+  const char *d = l->data[field] + (size_t) row * l->stride[field];
+  uint16_t u16;
+  int v;
 
-  fgets(line, 800, f);
-  
-  for (i = 1; i < 601; i++) {
-    fgets(line, 800, f);
-    experience[i].growth_rate_id = atoi((tmp = next_token(line, ',')));
-    tmp = next_token(NULL, ',');
-    experience[i].level = *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    experience[i].experience =  (*tmp != '\n') ? atoi(tmp) : INT_MAX;
+  switch (l->schema->fields[field].kind) {
+  case db_u8:
+    return *(const uint8_t *) d == DB_BLANK8 ? INT_MAX : *(const uint8_t *) d;
+  case db_u16:
+    memcpy(&u16, d, sizeof (u16));
+    return u16 == DB_BLANK16 ? INT_MAX : u16;
+  default:
+    memcpy(&v, d, sizeof (v));
+    return v;
   }
+}
+
+/* Reads a CSV in and matches its headings to its schema's fields */
+static int db_open(db_load_t *l, const char *prefix, db_table_t table)
+{
+  std::vector<bool> found;
+  struct stat buf;
+  char *path, *p, *s, *e;
+  FILE *f;
+  int col, i;
 
+  l->schema = db_schemas + table;
+  path = (char *) malloc(strlen(prefix) + strlen(l->schema->file) + 1);
+  strcpy(path, prefix);
+  strcat(path, l->schema->file);
+  if (!(f = fopen(path, "r"))) {
+    perror(path);
+    free(path);
+    return 1;
+  }
+  if (fstat(fileno(f), &buf) ||
+      !(l->text = (char *) malloc(buf.st_size + 1)) ||
+      fread(l->text, 1, buf.st_size, f) != (size_t) buf.st_size) {
+    perror(path);
+    fclose(f);
+    free(path);
+    return 1;
+  }
+  l->text[buf.st_size] = '\0';
   fclose(f);
+  free(path);
 
-  if (print) {
-    f = fopen("experience.csv", "w");
-    for (i = 1; i < 601; i++) {
-      fprintf(f, "%s,%s,%s\n",
-              i2s(experience[i].growth_rate_id),
-              i2s(experience[i].level),
-              i2s(experience[i].experience));
+  found.assign(l->schema->num_fields, false);
+  l->filter = -1;
+  for (p = l->text, col = 0; ; col++) {
+    if (col == DB_MAX_COLUMNS) {
+      fprintf(stderr, "%s: More than %d columns\n", l->schema->file,
+              DB_MAX_COLUMNS);
+      return 1;
+    }
+    e = db_next_field(s = p, &p);
+    l->field[col] = -1;
+    for (i = 0; i < l->schema->num_fields; i++) {
+      if (!found[i] && !strncmp(l->schema->fields[i].name, s, e - s) &&
+          !l->schema->fields[i].name[e - s]) {
+        l->field[col] = i;
+        found[i] = true;
+      }
+    }
+    if (l->schema->filter && !strncmp(l->schema->filter, s, e - s) &&
+        !l->schema->filter[e - s]) {
+      l->filter = col;
+    }
+    if (*p != ',') {
+      break;
+    }
+    p++;
+  }
+  l->num_columns = col + 1;
+  l->body = *p ? p + 1 : p;
+
+  for (i = 0; i < l->schema->num_fields; i++) {
+    if (!found[i]) {
+      fprintf(stderr, "%s: No %s column\n", l->schema->file,
+              l->schema->fields[i].name);
+      return 1;
     }
-    fclose(f);
   }
 
-  prefix = (char *) realloc(prefix, prefix_len + strlen("type_names.csv") + 1);
-  strcpy(prefix + prefix_len, "type_names.csv");
-  
-  f = fopen(prefix, "r");
+  return 0;
+}
 
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
+/* Sizes a CSV, and cuts it up into chunks.  A filtered one is left in  *
+ * one piece, since which row a line goes in depends on the ones above. */
+static void db_count(db_load_t *l, std::vector<db_chunk_t> &chunks)
+{
+  size_t first;
+  char *p;
+  int line;
 
-  fgets(line, 800, f);
-  
-  for (i = 1; i < 19; i++) {
-    fgets(line, 800, f); //  1
-    fgets(line, 800, f); //  3
-    fgets(line, 800, f); //  4
-    fgets(line, 800, f); //  5
-    fgets(line, 800, f); //  6
-    fgets(line, 800, f); //  7
-    fgets(line, 800, f); //  8
-    fgets(line, 800, f); //  9 - English
-    for (j = count = 0; count < 2; j++) {
-      if (line[j] == ',') {
-        count++;
+  first = chunks.size();
+  for (l->size = 1, line = 2, p = l->body; *p; line++) {
+    if (!db_blank_line(p)) {
+      if (l->size == 1 ||
+          (!l->schema->filter && !((l->size - 1) % DB_CHUNK_ROWS))) {
+        chunks.push_back({ l, p, NULL, l->size, line });
       }
+      l->size++;
+    }
+    if (*(p = db_line_end(p))) {
+      p++;
     }
-    line[strlen(line) - 1] = '\0';
-    types[i] = strdup(line + j);
-    fgets(line, 800, f); // 11
-    fgets(line, 800, f); // 12
   }
 
-  fclose(f);
+  for (; first < chunks.size(); first++) {
+    chunks[first].end = (first + 1 < chunks.size() ?
+                         chunks[first + 1].start : p);
+  }
+}
+
+static int db_parse_chunk(db_chunk_t *c)
+{
+  db_load_t *l = c->load;
+  uint32_t row;
+  char *p, *s, *e;
+  int line, col, v;
+  bool keep;
 
-  if (print) {
-    f = fopen("type_names.csv", "w");
-    for (i = 1; i < 19; i++) {
-      fprintf(f, "%s\n", types[i]);
+  for (row = c->row, line = c->line, p = c->start; p < c->end; line++) {
+    if (db_blank_line(p)) {
+      p = db_line_end(p) + 1;
+      continue;
     }
-    fclose(f);
+
+    for (keep = true, col = 0; ; col++) {
+      e = db_next_field(s = p, &p);
+      if (col == l->num_columns) {
+        fprintf(stderr, "%s line %d: More than %d columns\n",
+                l->schema->file, line, l->num_columns);
+        return 1;
+      }
+      if (l->field[col] >= 0 && db_store(l, l->field[col], row, s, e, line)) {
+        return 1;
+      }
+      if (col == l->filter) {
+        keep = !db_number(s, e, &v) && v == l->schema->filter_value;
+      }
+      if (*p != ',') {
+        break;
+      }
+      p++;
+    }
+    /* Columns missing off the end are blank */
+    for (col++; col < l->num_columns; col++) {
+      if (l->field[col] >= 0 && db_store(l, l->field[col], row, p, p, line)) {
+        return 1;
+      }
+    }
+    if (*p) {
+      p++;
+    }
+
+    if (keep) {
+      row++;
+    }
+  }
+
+  if (l->schema->filter) {
+    l->size = row;
   }
 
-  prefix = (char *) realloc(prefix,
-                            prefix_len + strlen("pokemon_stats.csv") + 1);
-  strcpy(prefix + prefix_len, "pokemon_stats.csv");
-  
-  f = fopen(prefix, "r");
+  return 0;
+}
 
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
+static void *db_worker(void *arg)
+{
+  db_work_t *w = (db_work_t *) arg;
+  size_t i;
 
-  fgets(line, 800, f);
-  
-  for (i = 1; i < 6553; i++) {
-    fgets(line, 800, f);
-    pokemon_stats[i].pokemon_id = atoi((tmp = next_token(line, ',')));
-    tmp = next_token(NULL, ',');
-    pokemon_stats[i].stat_id = *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    pokemon_stats[i].base_stat =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    pokemon_stats[i].effort =  (*tmp != '\n') ? atoi(tmp) : INT_MAX;
+  while (!w->failed && (i = w->next.fetch_add(1)) < w->chunks.size()) {
+    trace_begin(w->chunks[i].load->schema->file, "db_parse");
+    if (db_parse_chunk(&w->chunks[i])) {
+      w->failed = 1;
+    }
+    trace_end(w->chunks[i].load->schema->file, "db_parse");
   }
 
-  fclose(f);
+  return NULL;
+}
 
-  if (print) {
-    f = fopen("pokemon_stats.csv", "w");
-    for (i = 1; i < 6553; i++) {
-      fprintf(f, "%s,%s,%s,%s\n",
-              i2s(pokemon_stats[i].pokemon_id),
-              i2s(pokemon_stats[i].stat_id),
-              i2s(pokemon_stats[i].base_stat),
-              i2s(pokemon_stats[i].effort));
+/* Column tables are sorted by their key, stably, so that the rows for  *
+ * a pokemon stay in the CSV's order (pokemon.cpp counts on it for the  *
+ * stats).  The CSVs come sorted, which takes one pass to find out.     */
+static void db_sort(db_load_t *l)
+{
+  const int key = l->schema->key;
+  std::vector<uint32_t> order;
+  std::vector<char> copy;
+  uint32_t i;
+  int f, w;
+
+  for (i = 2; i < l->size && db_get(l, key, i - 1) <= db_get(l, key, i); i++)
+    ;
+  if (i >= l->size) {
+    return;
+  }
+
+  for (order.resize(l->size - 1), i = 0; i < order.size(); i++) {
+    order[i] = i + 1;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [l, key](uint32_t a, uint32_t b) {
+                     return db_get(l, key, a) < db_get(l, key, b);
+                   });
+
+  for (f = 0; f < l->schema->num_fields; f++) {
+    w = l->stride[f];
+    copy.assign(l->data[f], l->data[f] + (size_t) l->size * w);
+    for (i = 0; i < order.size(); i++) {
+      memcpy(l->data[f] + (size_t) (i + 1) * w,
+             copy.data() + (size_t) order[i] * w, w);
     }
-    fclose(f);
   }
-  
-  prefix = (char *) realloc(prefix, prefix_len + strlen("stats.csv") + 1);
-  strcpy(prefix + prefix_len, "stats.csv");
-  
-  f = fopen(prefix, "r");
-
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
-
-  fgets(line, 800, f);
-  
-  for (i = 1; i < 9; i++) {
-    fgets(line, 800, f);
-    stats[i].id = atoi((tmp = next_token(line, ',')));
-    tmp = next_token(NULL, ',');
-    stats[i].damage_class_id = *tmp ? atoi(tmp) : INT_MAX;
-    strcpy(stats[i].identifier, (tmp = next_token(NULL, ',')));
-    tmp = next_token(NULL, ',');
-    stats[i].is_battle_only =  *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    stats[i].game_index =  (*tmp != '\n') ? atoi(tmp) : INT_MAX;
+}
+
+/* Writes a table back out as a CSV, to . */
+static int db_write(const db_load_t *l)
+{
+  const db_schema_t *s = l->schema;
+  uint32_t row;
+  FILE *f;
+  int i, v;
+
+  if (!(f = fopen(s->file, "w"))) {
+    perror(s->file);
+    return 1;
   }
 
-  fclose(f);
-  
-  if (print) {
-    f = fopen("stats.csv", "w");
-    for (i = 1; i < 9; i++) {
-      fprintf(f, "%s,%s,%s,%s,%s\n",
-              i2s(stats[i].id),
-              i2s(stats[i].damage_class_id),
-              stats[i].identifier,
-              i2s(stats[i].is_battle_only),
-              i2s(stats[i].game_index));
+  for (i = 0; i < s->num_fields; i++) {
+    fprintf(f, "%s%c", s->fields[i].name, i + 1 < s->num_fields ? ',' : '\n');
+  }
+  for (row = 1; row < l->size; row++) {
+    for (i = 0; i < s->num_fields; i++) {
+      if (s->fields[i].kind == db_string) {
+        fputs(l->data[i] + (size_t) row * l->stride[i], f);
+      } else if ((v = db_get(l, i, row)) != INT_MAX) {
+        fprintf(f, "%d", v);
+      }
+      fputc(i + 1 < s->num_fields ? ',' : '\n', f);
     }
-    fclose(f);
   }
 
-  prefix = (char *) realloc(prefix,
-                            prefix_len + strlen("pokemon_types.csv") + 1);
-  strcpy(prefix + prefix_len, "pokemon_types.csv");
-  
-  f = fopen(prefix, "r");
+  if (fclose(f)) {
+    perror(s->file);
+    return 1;
+  }
 
-  //No null byte copied here, so prefix is not technically a string anymore.
-  prefix = (char *) realloc(prefix, prefix_len + 1);
+  return 0;
+}
 
-  fgets(line, 800, f);
-  
-  for (i = 1; i < 1676; i++) {
-    fgets(line, 800, f);
-    pokemon_types[i].pokemon_id = atoi((tmp = next_token(line, ',')));
-    tmp = next_token(NULL, ',');
-    pokemon_types[i].type_id = *tmp ? atoi(tmp) : INT_MAX;
-    tmp = next_token(NULL, ',');
-    pokemon_types[i].slot = (*tmp != '\n') ? atoi(tmp) : INT_MAX;
+db_tables *db_read(bool print)
+{
+  db_load_t load[num_db_tables];
+  std::vector<pthread_t> pool;
+  db_work_t work;
+  db_tables *t;
+  uint64_t size;
+  char *prefix;
+  int i, f, failed;
+
+  if (!(prefix = db_prefix())) {
+    fprintf(stderr, "Couldn't find the pokedex\n");
+    return NULL;
   }
 
-  fclose(f);
-  
-  if (print) {
-    f = fopen("pokemon_types.csv", "w");
-    for (i = 1; i < 1676; i++) {
-      fprintf(f, "%s,%s,%s\n",
-              i2s(pokemon_types[i].pokemon_id),
-              i2s(pokemon_types[i].type_id),
-              i2s(pokemon_types[i].slot));
+  memset(load, 0, sizeof (load));
+  for (failed = 0, i = 0; !failed && i < num_db_tables; i++) {
+    failed = db_open(load + i, prefix, (db_table_t) i);
+  }
+  free(prefix);
+
+  /* Lay the block out to fit */
+  t = NULL;
+  if (!failed) {
+    size = DB_ALIGN(sizeof (db_tables));
+    for (i = 0; i < num_db_tables; i++) {
+      db_count(load + i, work.chunks);
+      size += db_table_bytes((db_table_t) i, load[i].size);
     }
-    fclose(f);
+    t = (db_tables *) calloc(1, size);
+    t->size = size;
+    for (size = DB_ALIGN(sizeof (db_tables)), i = 0; i < num_db_tables; i++) {
+      t->table[i].size = load[i].size;
+      t->table[i].offset = size;
+      size += db_table_bytes((db_table_t) i, load[i].size);
+      for (f = 0; f < load[i].schema->num_fields; f++) {
+        load[i].data[f] = (char *) db_column(t, (db_table_t) i, f);
+        if (load[i].schema->row_size) {
+          load[i].data[f] += load[i].schema->fields[f].offset;
+          load[i].stride[f] = load[i].schema->row_size;
+        } else {
+          load[i].stride[f] = db_width(load[i].schema->fields[f].kind);
+        }
+      }
+    }
+
+    work.next = 0;
+    work.failed = 0;
+    pool.resize(db_threads - 1);
+    for (i = 0; i < (int) pool.size(); i++) {
+      if (pthread_create(&pool[i], NULL, db_worker, &work)) {
+        pool.resize(i);
+      }
+    }
+    db_worker(&work);
+    for (i = 0; i < (int) pool.size(); i++) {
+      pthread_join(pool[i], NULL);
+    }
+    failed = work.failed;
   }
 
+  for (i = 0; !failed && i < num_db_tables; i++) {
+    if (!load[i].schema->row_size) {
+      db_sort(load + i);
+    }
+    /* Filtering may have left it smaller than it was laid out */
+    t->table[i].size = load[i].size;
+    if (print) {
+      failed = db_write(load + i);
+    }
+  }
 
-  free(prefix);
+  for (i = 0; i < num_db_tables; i++) {
+    free(load[i].text);
+  }
+  if (failed) {
+    free(t);
+    return NULL;
+  }
+
+  return t;
 }
+
+void db_parse(bool print)
+{
+  db_tables *t;
+
+  if (!(t = db_read(print))) {
+    exit(1);
+  }
+  db_use_version(new db_version(t, t));
+}
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef DB_PARSE_H
 # define DB_PARSE_H
 
+#include <stdint.h>
+#include <memory>
 #include <vector>
 
 struct pokemon_db {
@@ -46,10 +48,8 @@ struct levelup_move {
   int move;
 };
 
-struct pokemon_species_db {
-  pokemon_species_db() : levelup_moves() {}
-  ~pokemon_species_db() {}
-  
+/* The columns of pokemon_species.csv */
+struct pokemon_species_row {
   int id;
   char identifier[30];
   int generation_id;
@@ -70,7 +70,14 @@ struct pokemon_species_db {
   int is_mythical;
   int order;
   int conquest_order;
+};
 
+struct pokemon_species_db : pokemon_species_row {
+  pokemon_species_db() : loaded(false), levelup_moves() {}
+  ~pokemon_species_db() {}
+
+  /* Set once levelup_moves and base_stat are filled in; see pokemon.cpp */
+  bool loaded;
   std::vector<levelup_move> levelup_moves;
   int base_stat[6];
 };
@@ -102,16 +109,199 @@ struct pokemon_types_db {
   int slot;
 };
 
-extern pokemon_move_db pokemon_moves[528239];
-extern pokemon_db pokemondb[1093];
-extern char *types[19];
-extern move_db moves[845];
-extern pokemon_species_db species[899];
-extern experience_db experience[601];
-extern pokemon_stats_db pokemon_stats[6553];
-extern stats_db stats[9];
-extern pokemon_types_db pokemon_types[1676];
+struct type_names_db {
+  int type_id;
+  int local_language_id;
+  char name[30];
+};
+
+struct type_efficacy_db {
+  int damage_type_id;
+  int target_type_id;
+  int damage_factor;
+};
+
+/* pokemon_moves.csv, pokemon_stats.csv and pokemon_types.csv are kept  *
+ * by column, each in the narrowest ints that hold it, and sorted by    *
+ * pokemon_id.  The game only ever scans them for a pokemon_id (and a   *
+ * method) and reads a column or two, which now touches a few bytes a   *
+ * row instead of all of it.  A blank is the column type's largest      *
+ * value.  db_pokemon_move() and friends give a row back in its CSV     *
+ * form, with INT_MAX for a blank.                                      */
+# define DB_BLANK8  UINT8_MAX
+# define DB_BLANK16 UINT16_MAX
+
+struct pokemon_move_columns {
+  const uint16_t *pokemon_id;
+  const uint8_t *version_group_id;
+  const uint16_t *move_id;
+  const uint8_t *pokemon_move_method_id;
+  const uint8_t *level;
+  const uint8_t *order;
+};
+
+struct pokemon_stat_columns {
+  const uint16_t *pokemon_id;
+  const uint8_t *stat_id;
+  const uint16_t *base_stat;
+  const uint8_t *effort;
+};
+
+struct pokemon_type_columns {
+  const uint16_t *pokemon_id;
+  const uint8_t *type_id;
+  const uint8_t *slot;
+};
+
+/* The CSVs, in the order they're loaded */
+typedef enum db_table {
+  db_pokemon_csv,
+  db_moves_csv,
+  db_pokemon_moves_csv,
+  db_pokemon_species_csv,
+  db_experience_csv,
+  db_type_names_csv,
+  db_pokemon_stats_csv,
+  db_stats_csv,
+  db_pokemon_types_csv,
+  db_type_efficacy_csv,
+  num_db_tables
+} db_table_t;
+
+/* Every table, as one block with no pointers in it, so that it can be *
+ * compiled in (DB_EMBED) or shared between processes (db_shm.h) as    *
+ * well as parsed.  The tables are as big as their CSVs, and follow    *
+ * this header at the offsets in it; each row table is an array of its *
+ * *_db struct, each column table its columns one after another.  Bump *
+ * DB_VERSION whenever the layout or any of the rows changes.          */
+# define DB_VERSION 3
+
+struct db_table_ref {
+  uint32_t size;        /* Rows, the unused row 0 included */
+  uint32_t offset;      /* From the start of the block */
+};
+
+struct db_tables {
+  uint64_t size;        /* Of the whole block, in bytes */
+  db_table_ref table[num_db_tables];
+};
+
+struct db_indexes;
+
+/* One version of the pokedex: a block, and everything the game works  *
+ * out from it, down to the indexes behind the lookups below.  Making  *
+ * one touches nothing else, so it can be done on any thread.  Once    *
+ * it's in use, only the main thread fills in a species' move list and *
+ * base stats (pokemon.cpp); the move learners are built once, by      *
+ * whichever thread first asks for them (db_move_learners()).          *
+ *                                                                     *
+ * Versions are reference counted.  Every pokemon holds on to the one  *
+ * it was made under and reads its moves and species from there, so a  *
+ * version stays around, unchanged, until the last of its pokemon is   *
+ * gone, however many newer ones have been put in use since.           */
+struct db_version {
+  /* owned, if not NULL, is t malloc()ed, freed along with the version */
+  db_version(const db_tables *t, db_tables *owned);
+  ~db_version();
+  db_version(const db_version &) = delete;
+  db_version &operator=(const db_version &) = delete;
+
+  const db_tables *tables;
+  db_tables *owned;
+  const pokemon_db *pokemondb;
+  const move_db *moves;
+  std::vector<pokemon_species_db> species;
+  const experience_db *experience;
+  const stats_db *stats;
+  pokemon_move_columns pokemon_moves;
+  pokemon_stat_columns pokemon_stats;
+  pokemon_type_columns pokemon_types;
+  const char *types[19];
+  int type_efficacy[19][19];
+  db_indexes *index;
+};
+
+/* The tables of the version in use, wherever they are; see db_use().  *
+ * Rows run from 1 up to db_size() of their table.                     */
+extern const pokemon_move_columns *pokemon_moves;
+extern const pokemon_db *pokemondb;
+extern const char *types[19];
+extern const move_db *moves;
+extern pokemon_species_db *species;
+extern const experience_db *experience;
+extern const pokemon_stat_columns *pokemon_stats;
+extern const stats_db *stats;
+extern const pokemon_type_columns *pokemon_types;
+/* Damage factor in percent (0, 50, 100 or 200) of a move of the first *
+ * type against a pokemon of the second.  Row and column 0 are 100, as *
+ * is any pair type_efficacy.csv leaves out.                           */
+extern const int (*type_efficacy)[19];
+
+int db_size(db_table_t table);
 
+/* Built with DB_EMBED (make embed), the tables are a constant compiled *
+ * into the binary from source poke327_dbgen generated out of the CSVs, *
+ * and db_parse() reads no files.                                       */
+#ifdef DB_EMBED
+extern const uint64_t db_embedded[];
+#endif
+
+/* Parses the CSVs into a block of this process's own and uses it, or *
+ * exits if it can't.                                                 */
 void db_parse(bool print);
+/* How many threads parsing uses; 1 (the default) for none */
+void db_parse_threads(int n);
+#ifndef DB_EMBED
+/* Parses the CSVs into a new block, sized to fit them, writing them  *
+ * back out to . if print.  Returns the block, to free() when no      *
+ * longer in use, or NULL, having said why, if a CSV couldn't be read *
+ * or doesn't fit its schema (db_parse.cpp).                          */
+db_tables *db_read(bool print);
+/* Where the CSVs are, malloc()ed, or NULL */
+char *db_prefix(void);
+#endif
+/* Puts v in use in place of the version that was, which lives on *
+ * as long as any pokemon made under it does.  Main thread only.  */
+void db_use_version(db_version *v);
+/* The same for a new version of t, which isn't freed with it */
+void db_use(const db_tables *t);
+/* The version in use, for holding on to */
+std::shared_ptr<db_version> db_current(void);
+
+pokemon_move_db db_pokemon_move(int i);
+pokemon_stats_db db_pokemon_stat(int i);
+pokemon_types_db db_pokemon_type(int i);
+
+/* Lookups over the tables of the version in use, answered from its    *
+ * indexes, so none of them scans a table.  The indexes belong to the  *
+ * process (they hold pointers), and are built with each version.      *
+ *                                                                     *
+ * The *_row() functions take an id and return its row in the table,   *
+ * and the db_find_*() ones do the same for an identifier; both return *
+ * 0, the header row, for one that isn't there.                        */
+int db_pokemon_row(int id);
+int db_move_row(int id);
+int db_species_row(int id);
+int db_find_pokemon(const char *identifier);
+int db_find_move(const char *identifier);
+int db_find_species(const char *identifier);
+int db_find_type(const char *identifier);
+
+/* Rows first up to (not including) end of a table */
+struct db_range {
+  int first;
+  int end;
+};
+
+/* A pokemon's rows in the tables sorted by pokemon_id; empty if none */
+db_range db_pokemon_move_rows(int pokemon_id);
+db_range db_pokemon_stat_rows(int pokemon_id);
+db_range db_pokemon_type_rows(int pokemon_id);
+
+/* The pokemon that can learn a move, any way and in any version, by *
+ * pokemon_id.  Sets *pokemon_ids to that list and returns its size. *
+ * The first call builds the list for every move; any others made at *
+ * the same time, on other threads, wait for it.                     */
+int db_move_learners(int move_id, const uint16_t **pokemon_ids);
 
 #endif
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <atomic>
+
+#include "db_reload.h"
+#include "db_parse.h"
+
+/* Loaded but not yet in use; the thread replaces one the game never  *
+ * got to, and the game takes it, leaving NULL.                       */
+static std::atomic<db_version *> db_reload_pending;
+
+int db_reload_poll(void)
+{
+  db_version *v;
+
+  /* Only one atomic load a turn while nothing has changed */
+  if (!db_reload_pending.load(std::memory_order_relaxed) ||
+      !(v = db_reload_pending.exchange(NULL, std::memory_order_acquire))) {
+    return 0;
+  }
+  db_use_version(v);
+
+  return 1;
+}
+
+#ifdef DB_EMBED
+
+int db_reload_start(void)
+{
+  fprintf(stderr, "The pokedex is compiled in; there's nothing to reload\n");
+
+  return 1;
+}
+
+void db_reload_stop(void)
+{
+}
+
+#else
+
+static int db_reload_fd;
+/* Readable once db_reload_stop() wants the thread to end */
+static int db_reload_quit_fd = -1;
+static pthread_t db_reload_thread;
+
+/* Waits up to timeout ms (-1 for ever) for a CSV to change.  Returns *
+ * 1 if one did, 0 if none did, -1 if the watch failed and -2 if      *
+ * db_reload_stop() was called.                                       */
+static int db_reload_wait(int timeout)
+{
+  char buf[4096]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *e;
+  struct pollfd pfd[2];
+  ssize_t n;
+  char *p;
+  size_t len;
+
+  pfd[0].fd = db_reload_fd;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = db_reload_quit_fd;
+  pfd[1].events = POLLIN;
+  for (;;) {
+    if ((n = poll(pfd, 2, timeout)) <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      return n;
+    }
+    if (pfd[1].revents) {
+      return -2;
+    }
+    if ((n = read(db_reload_fd, buf, sizeof (buf))) <= 0) {
+      return -1;
+    }
+    for (p = buf; p < buf + n; p += sizeof (*e) + e->len) {
+      e = (const struct inotify_event *) p;
+      if (e->len && (len = strlen(e->name)) > 4 &&
+          !strcmp(e->name + len - 4, ".csv")) {
+        return 1;
+      }
+    }
+  }
+}
+
+static void *db_reload_watch(void *arg)
+{
+  db_tables *t;
+  int r;
+
+  while ((r = db_reload_wait(-1)) > 0) {
+    /* Let the rest of a batch of edits land first */
+    while ((r = db_reload_wait(DB_RELOAD_QUIET_MS)) > 0)
+      ;
+    if (r < 0) {
+      break;
+    }
+
+    if (!(t = db_read(false))) {
+      fprintf(stderr, "Keeping the pokedex in use\n");
+      continue;
+    }
+    delete db_reload_pending.exchange(new db_version(t, t),
+                                      std::memory_order_release);
+  }
+  if (r == -1) {
+    perror("pokedex watch");
+  }
+
+  return NULL;
+}
+
+int db_reload_start(void)
+{
+  char *prefix;
+
+  if (!(prefix = db_prefix())) {
+    fprintf(stderr, "Couldn't find the pokedex\n");
+    return 1;
+  }
+  if ((db_reload_fd = inotify_init1(IN_CLOEXEC)) < 0) {
+    perror("inotify");
+    free(prefix);
+    return 1;
+  }
+  if (inotify_add_watch(db_reload_fd, prefix,
+                        IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    perror(prefix);
+    free(prefix);
+    close(db_reload_fd);
+    return 1;
+  }
+  free(prefix);
+
+  if ((db_reload_quit_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+    perror("eventfd");
+    close(db_reload_fd);
+    return 1;
+  }
+  if (pthread_create(&db_reload_thread, NULL, db_reload_watch, NULL)) {
+    fprintf(stderr, "Couldn't start the pokedex watch\n");
+    close(db_reload_quit_fd);
+    close(db_reload_fd);
+    db_reload_quit_fd = -1;
+    return 1;
+  }
+
+  return 0;
+}
+
+void db_reload_stop(void)
+{
+  uint64_t one = 1;
+
+  if (db_reload_quit_fd < 0) {
+    return;
+  }
+
+  if (write(db_reload_quit_fd, &one, sizeof (one)) != sizeof (one)) {
+    perror("eventfd");
+  }
+  pthread_join(db_reload_thread, NULL);
+  close(db_reload_quit_fd);
+  close(db_reload_fd);
+  db_reload_quit_fd = -1;
+
+  /* One the game never got to */
+  delete db_reload_pending.exchange(NULL, std::memory_order_acquire);
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef DB_RELOAD_H
+# define DB_RELOAD_H
+
+/* Opt-in (--reload) reloading of the pokedex while the game runs, so   *
+ * that edits to the CSVs take effect without a restart.                *
+ *                                                                      *
+ * A thread watches the CSV directory with inotify.  Once a CSV there   *
+ * has been written (or renamed into place) and the directory has been  *
+ * quiet for DB_RELOAD_QUIET_MS, so that a batch of edits is loaded     *
+ * once, it parses them all into a new db_version (db_parse.h) and      *
+ * leaves it for the main thread; it never touches the version in use.  *
+ * db_reload_poll(), between turns, puts the newest one in use.         *
+ *                                                                      *
+ * Pokemon made before then keep the version they were made under for   *
+ * the rest of their lives, stats, moves and names alike; only new ones *
+ * see the change.  A CSV that doesn't parse is reported and the old    *
+ * version stays in use until the next change.  A recording made across *
+ * a reload only replays with the same edits made at the same turns.    *
+ * The embedded build (DB_EMBED) has no CSVs to watch.                  */
+
+# define DB_RELOAD_QUIET_MS 200
+
+/* Returns 0 once the watch is running, non-zero, having said why, if  *
+ * it can't be.                                                        */
+int db_reload_start(void);
+/* Puts a newly loaded version in use, if there is one, returning 1 if *
+ * there was.  Main thread only.                                       */
+int db_reload_poll(void);
+/* Ends the watch, waiting for a load in progress to finish, and frees *
+ * any version it left that never went in use.  Does nothing if it     *
+ * wasn't started.                                                     */
+void db_reload_stop(void);
+
+#endif
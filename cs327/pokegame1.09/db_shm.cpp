@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "db_shm.h"
+#include "db_parse.h"
+
+#define DB_SHM_MAGIC "poke327"
+
+typedef struct db_shm_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t ready;       /* Stored last, once the tables are loaded */
+  uint64_t size;        /* Of the block */
+} db_shm_header_t;
+
+/* The block starts a cache line in */
+#define DB_SHM_OFFSET 64
+
+#ifdef DB_EMBED
+
+/* The embedded tables are already shared by every process running the *
+ * binary, so there's nothing to gain.                                 */
+int db_shm_load(const char *name)
+{
+  db_parse(false);
+
+  return 0;
+}
+
+#else
+
+static void db_shm_sleep(void)
+{
+  struct timespec ts = { 0, 1000000 };
+
+  nanosleep(&ts, NULL);
+}
+
+/* We made the segment: fill it in.  How big it is depends on the CSVs, *
+ * so they're parsed first, and it stays empty until they have been.    */
+static int db_shm_create(const char *path, int fd, db_shm_header_t **h)
+{
+  db_tables *t;
+  size_t size;
+  void *p;
+
+  if (!(t = db_read(false))) {
+    return 1;
+  }
+  size = DB_SHM_OFFSET + t->size;
+  if (ftruncate(fd, size)) {
+    perror(path);
+    free(t);
+    return 1;
+  }
+  if ((p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0)) == MAP_FAILED) {
+    perror(path);
+    free(t);
+    return 1;
+  }
+
+  *h = (db_shm_header_t *) p;
+  memcpy((*h)->magic, DB_SHM_MAGIC, sizeof (DB_SHM_MAGIC));
+  (*h)->version = DB_VERSION;
+  (*h)->size = t->size;
+  memcpy((char *) p + DB_SHM_OFFSET, t, t->size);
+  free(t);
+  __atomic_store_n(&(*h)->ready, 1, __ATOMIC_RELEASE);
+
+  /* Nobody writes to it from here on, us included */
+  mprotect(p, size, PROT_READ);
+
+  return 0;
+}
+
+/* Somebody else made it: wait for it to be ready */
+static int db_shm_attach(const char *path, db_shm_header_t **h)
+{
+  struct stat buf;
+  void *p;
+  int fd, waited;
+
+  if ((fd = shm_open(path, O_RDONLY, 0)) < 0) {
+    perror(path);
+    return 1;
+  }
+
+  /* It's empty until its creator gets as far as ftruncate() */
+  for (waited = 0; ; waited++) {
+    if (fstat(fd, &buf)) {
+      perror(path);
+      close(fd);
+      return 1;
+    }
+    if ((uint64_t) buf.st_size > DB_SHM_OFFSET || waited == DB_SHM_WAIT_MS) {
+      break;
+    }
+    db_shm_sleep();
+  }
+  if ((uint64_t) buf.st_size <= DB_SHM_OFFSET) {
+    fprintf(stderr, "%s: Never finished loading; remove it and retry\n",
+            path);
+    close(fd);
+    return 1;
+  }
+
+  p = mmap(NULL, buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    perror(path);
+    return 1;
+  }
+
+  *h = (db_shm_header_t *) p;
+  for (; !__atomic_load_n(&(*h)->ready, __ATOMIC_ACQUIRE) &&
+         waited < DB_SHM_WAIT_MS; waited++) {
+    db_shm_sleep();
+  }
+  if (!(*h)->ready) {
+    fprintf(stderr, "%s: Never finished loading; remove it and retry\n",
+            path);
+    munmap(p, buf.st_size);
+    return 1;
+  }
+  if (memcmp((*h)->magic, DB_SHM_MAGIC, sizeof (DB_SHM_MAGIC)) ||
+      (*h)->version != DB_VERSION ||
+      (*h)->size != (uint64_t) buf.st_size - DB_SHM_OFFSET) {
+    fprintf(stderr, "%s: Not a pokedex of this version\n", path);
+    munmap(p, buf.st_size);
+    return 1;
+  }
+
+  return 0;
+}
+
+int db_shm_load(const char *name)
+{
+  db_shm_header_t *h;
+  char path[256];
+  int fd;
+
+  snprintf(path, sizeof (path), "%s%s-v%d",
+           *name == '/' ? "" : "/", name, DB_VERSION);
+
+  /* Exactly one process gets to create it */
+  if ((fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0444)) >= 0) {
+    if (db_shm_create(path, fd, &h)) {
+      shm_unlink(path);
+      close(fd);
+      return 1;
+    }
+    close(fd);
+  } else if (errno != EEXIST) {
+    perror(path);
+    return 1;
+  } else if (db_shm_attach(path, &h)) {
+    return 1;
+  }
+
+  db_use((db_tables *) ((char *) h + DB_SHM_OFFSET));
+
+  return 0;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef DB_SHM_H
+# define DB_SHM_H
+
+/* Opt-in (--shm <name>) pokedex shared between game processes through a *
+ * named POSIX shared memory segment.  The first process to ask for a    *
+ * name creates the segment, parses the CSVs into a block of its own     *
+ * (db_read()), copies that into the segment, frees it and marks         *
+ * the segment ready; every later one maps it read-only and starts       *
+ * without opening a single CSV.  All of them read the tables from the   *
+ * segment.  What each works out from them (db_use(): the indexes behind *
+ * the lookups, and the species rows filled in as pokemon are made) is   *
+ * its own, since it holds pointers or changes as the game runs.         *
+ *                                                                       *
+ * The segment is a small header (DB_VERSION and the size of the block)  *
+ * followed by the db_tables block (db_parse.h), which has no pointers   *
+ * in it.  The name gets the version appended, <name>-v<DB_VERSION>, so  *
+ * builds with different layouts never share a segment.  It outlives     *
+ * the processes, which is the point; after changing the CSVs, remove it *
+ * (it's /dev/shm/<name>-v<DB_VERSION> on Linux).                        */
+
+/* How long a process waits for another one to finish loading */
+# define DB_SHM_WAIT_MS 10000
+
+/* Returns 0 once the tables are in use, non-zero (having said why) if *
+ * they couldn't be shared, in which case db_parse() still works.      */
+int db_shm_load(const char *name);
+
+#endif
@@ -0,0 +1,61 @@
+/**************************************************************************
+ * Writes the pokedex as C++ source, for the embedded build (make embed). *
+ *                                                                        *
+ * Parses the CSVs the way the game does (db_read()), then writes the     *
+ * block out as one constant array of 64-bit words, db_embedded.          *
+ * Compiled with DB_EMBED, the result replaces the parsing: the tables    *
+ * are in the binary's read-only data, paged in from the executable on    *
+ * demand and shared by every process running it.                         *
+ **************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "db_parse.h"
+
+static void dbgen_write(FILE *out, const db_tables *t)
+{
+  uint64_t i, word;
+
+  fprintf(out, "/* Generated by poke327_dbgen from the pokedex CSVs.  "
+          "Do not edit. */\n\n#include \"db_parse.h\"\n\n"
+          "const uint64_t db_embedded[] = {\n");
+
+  /* The block's size is a multiple of 8 */
+  for (i = 0; i < t->size / sizeof (word); i++) {
+    memcpy(&word, (const char *) t + i * sizeof (word), sizeof (word));
+    fprintf(out, "%#llx,%s", (unsigned long long) word,
+            i % 8 == 7 ? "\n" : "");
+  }
+  fprintf(out, "};\n");
+}
+
+int main(int argc, char *argv[])
+{
+  db_tables *t;
+  FILE *out;
+
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <file.cpp>\n", argv[0]);
+    return 1;
+  }
+
+  if (!(t = db_read(false))) {
+    return 1;
+  }
+
+  if (!(out = fopen(argv[1], "w"))) {
+    perror(argv[1]);
+    return 1;
+  }
+  dbgen_write(out, t);
+  if (fclose(out)) {
+    perror(argv[1]);
+    return 1;
+  }
+  free(t);
+
+  return 0;
+}
@@ -0,0 +1,63 @@
+#ifndef HEADLESS_H
+# define HEADLESS_H
+
+/* Stand-in for <ncurses.h> in the headless build.  io.cpp is compiled     *
+ * against these no-op versions of the handful of curses calls it makes,   *
+ * so the game logic runs unchanged with no terminal and no libncurses.    *
+ * Input does not come through here; io_getch() and io_getint() supply it. */
+
+# include <stdio.h>
+# include <stdlib.h>
+
+# define TRUE  1
+# define FALSE 0
+# define ERR   (-1)
+# define OK    0
+
+# define COLOR_BLACK   0
+# define COLOR_RED     1
+# define COLOR_GREEN   2
+# define COLOR_YELLOW  3
+# define COLOR_BLUE    4
+# define COLOR_MAGENTA 5
+# define COLOR_CYAN    6
+# define COLOR_WHITE   7
+
+# define COLOR_PAIR(n) ((n) << 8)
+
+/* Same codes as ncurses so the switch statements in io.cpp don't change. */
+# define KEY_DOWN  0402
+# define KEY_UP    0403
+# define KEY_LEFT  0404
+# define KEY_RIGHT 0405
+# define KEY_HOME  0406
+# define KEY_NPAGE 0522
+# define KEY_PPAGE 0523
+# define KEY_B2    0536
+# define KEY_END   0550
+
+typedef struct headless_window WINDOW;
+
+# define stdscr ((WINDOW *) 0)
+
+static inline WINDOW *initscr(void) { return stdscr; }
+static inline int endwin(void) { return OK; }
+static inline int raw(void) { return OK; }
+static inline int echo(void) { return OK; }
+static inline int noecho(void) { return OK; }
+static inline int curs_set(int) { return OK; }
+static inline int keypad(WINDOW *, int) { return OK; }
+static inline int start_color(void) { return OK; }
+static inline int init_pair(short, short, short) { return OK; }
+static inline int attron(int) { return OK; }
+static inline int attroff(int) { return OK; }
+static inline int refresh(void) { return OK; }
+static inline int clear(void) { return OK; }
+static inline int move(int, int) { return OK; }
+static inline int clrtobot(void) { return OK; }
+static inline int clrtoeol(void) { return OK; }
+static inline int mvaddch(int, int, int) { return OK; }
+static inline int mvaddnstr(int, int, const char *, int) { return OK; }
+static inline int mvprintw(int, int, const char *, ...) { return OK; }
+
+#endif
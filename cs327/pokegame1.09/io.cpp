@@ -1,7 +1,12 @@
 #include <unistd.h>
-#include <ncurses.h>
+#ifdef HEADLESS
+# include "headless.h"
+#else
+# include <ncurses.h>
+#endif
 #include <ctype.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <limits.h>
 #include <string.h>
 #include <vector>
@@ -11,15 +16,139 @@
 #include "poke327.h"
 #include "pokemon.h"
 #include "db_parse.h"
+#include "replay.h"
+#include "stats.h"
+#include "trace.h"
+#include "battle.h"
+#include "battle_ai.h"
+
+/* Messages live in a fixed ring, so queueing one never allocates.  The   *
+ * ring holds the last IO_MESSAGE_SLOTS messages: those from io_msg_shown *
+ * to io_msg_end are waiting to be printed, and those before io_msg_shown *
+ * are the history that 'M' scrolls through.  The counters run freely;    *
+ * mask them to index the ring.  Must be a power of two.                  */
+#define IO_MESSAGE_SLOTS 128
 
 typedef struct io_message {
   /* Will print " --more-- " at end of line when another message follows. *
    * Leave 10 extra spaces for that.                                      */
   char msg[71];
-  struct io_message *next;
+  uint32_t repeat; /* Times it was queued in a row */
 } io_message_t;
 
-static io_message_t *io_head, *io_tail;
+static io_message_t io_msg[IO_MESSAGE_SLOTS];
+static uint32_t io_msg_shown, io_msg_end;
+
+/* Set while a battle menu owns the input, so the headless PC knows *
+ * whether it is being asked for a direction or a battle command.   */
+static int io_in_battle;
+
+/* Toggled with 'S'; draws the per-phase timings over the map. */
+static int io_show_stats;
+
+#ifdef HEADLESS
+/**************************************************************************
+ * The headless PC.  There is nobody at the keyboard, so every key the    *
+ * game asks for is made up here.  On the map it walks in a random        *
+ * direction (or rests); in a battle it always fights with a random move. *
+ * Every menu in io.cpp accepts at least one key from each of these sets, *
+ * so no prompt can spin forever.                                         *
+ *                                                                        *
+ * The PC draws from its own generator, seeded from the world seed, and   *
+ * leaves rand() to the game.  That way the game consumes exactly the     *
+ * same random numbers whether its input comes from here, a keyboard, or  *
+ * a recording, and any recorded session replays in either build.         *
+ **************************************************************************/
+static unsigned int io_pc_rand_state;
+
+static int io_pc_getch()
+{
+  static const char map_keys[] = "123456789";
+  static const char battle_keys[] = "f1234";
+
+  if (io_in_battle) {
+    return battle_keys[rand_r(&io_pc_rand_state) % (sizeof (battle_keys) - 1)];
+  }
+
+  return map_keys[rand_r(&io_pc_rand_state) % (sizeof (map_keys) - 1)];
+}
+#endif
+
+/* Pulls the next input out of the recording being replayed.  A recording *
+ * that runs out or stops matching what the game asks for can't be        *
+ * continued, so that ends the game.                                      */
+static int io_replay_next(char kind)
+{
+  int value;
+
+  switch (replay_next(kind, &value)) {
+  case 0:
+    return value;
+  case 1:
+    io_reset_terminal();
+    fprintf(stderr, "Recording ended after %u turns, "
+            "before the game did.\n", world.turn_count);
+    break;
+  default:
+    io_reset_terminal();
+    fprintf(stderr, "Recording does not match the game at turn %u "
+            "(different seed, binary, or database?).\n", world.turn_count);
+    break;
+  }
+
+  replay_close();
+  exit(1);
+}
+
+/* All keyboard input goes through here, so it can be recorded and  *
+ * replayed.  Replayed input is recorded too, so a replay can be    *
+ * re-recorded (e.g. cut short with -t).                            */
+static int io_getch()
+{
+  int key;
+
+  if (replay_playing()) {
+    key = io_replay_next(REPLAY_KEY);
+  } else {
+#ifdef HEADLESS
+    key = io_pc_getch();
+#else
+    stats_idle idle;
+
+    key = getch();
+#endif
+  }
+  replay_record(REPLAY_KEY, key);
+
+  return key;
+}
+
+/* Reads an integer typed at (y, x), or INT_MAX if none was entered. */
+static int io_getint(int y, int x)
+{
+  int i;
+
+  if (replay_playing()) {
+    i = io_replay_next(REPLAY_INT);
+  } else {
+    /* mvscanw documentation is unclear about return values.  I believe *
+     * that the return value works the same way as scanf, but instead   *
+     * of counting on that, we'll initialize i to an out of bounds      *
+     * value and accept its update only if in range.                    */
+    i = INT_MAX;
+#ifdef HEADLESS
+    /* Fly prompt is the only caller */
+    i = rand_r(&io_pc_rand_state) % 401 - 200;
+#else
+    stats_idle idle;
+
+    mvscanw(y, x, "%d", &i);
+#endif
+  }
+  replay_record(REPLAY_INT, i);
+
+  return i;
+}
 
 void io_init_terminal(void)
 {
@@ -36,64 +165,90 @@ void io_init_terminal(void)
   init_pair(COLOR_MAGENTA, COLOR_MAGENTA, COLOR_BLACK);
   init_pair(COLOR_CYAN, COLOR_CYAN, COLOR_BLACK);
   init_pair(COLOR_WHITE, COLOR_WHITE, COLOR_BLACK);
+
+#ifdef HEADLESS
+  io_pc_rand_state = world.seed;
+#endif
 }
 
 void io_reset_terminal(void)
 {
   endwin();
 
-  while (io_head) {
-    io_tail = io_head;
-    io_head = io_head->next;
-    free(io_tail);
-  }
-  io_tail = NULL;
+  io_msg_shown = io_msg_end = 0;
 }
 
+/**************************************************************************
+ * Queues a message to be shown at the next io_display().  The same       *
+ * message queued again before it was shown is counted rather than        *
+ * repeated, so it shows once with "(xN)".  If the ring is full of        *
+ * unshown messages, the oldest is dropped to make room.                  *
+ **************************************************************************/
 void io_queue_message(const char *format, ...)
 {
-  io_message_t *tmp;
+  char msg[sizeof (io_msg[0].msg)];
+  io_message_t *m;
   va_list ap;
 
-  if (!(tmp = (io_message_t *) malloc(sizeof (*tmp)))) {
-    perror("malloc");
-    exit(1);
-  }
-
-  tmp->next = NULL;
-
   va_start(ap, format);
 
-  vsnprintf(tmp->msg, sizeof (tmp->msg), format, ap);
+  vsnprintf(msg, sizeof (msg), format, ap);
 
   va_end(ap);
 
-  if (!io_head) {
-    io_head = io_tail = tmp;
-  } else {
-    io_tail->next = tmp;
-    io_tail = tmp;
+  if (io_msg_end != io_msg_shown) {
+    m = &io_msg[(io_msg_end - 1) & (IO_MESSAGE_SLOTS - 1)];
+    if (!strcmp(m->msg, msg)) {
+      m->repeat++;
+      return;
+    }
+  }
+
+  if (io_msg_end - io_msg_shown == IO_MESSAGE_SLOTS) {
+    io_msg_shown++;
   }
+
+  m = &io_msg[io_msg_end++ & (IO_MESSAGE_SLOTS - 1)];
+  strcpy(m->msg, msg);
+  m->repeat = 1;
+}
+
+/* The message as printed, with its repeat count if it has one. *
+ * buf must hold at least sizeof (io_msg[0].msg) characters.    */
+static const char *io_message_text(const io_message_t *m, char *buf)
+{
+  char count[16];
+  int n;
+
+  if (m->repeat == 1) {
+    return m->msg;
+  }
+
+  n = snprintf(count, sizeof (count), " (x%u)", m->repeat);
+  snprintf(buf, sizeof (io_msg[0].msg), "%.*s%s",
+           (int) sizeof (io_msg[0].msg) - 1 - n, m->msg, count);
+
+  return buf;
 }
 
 static void io_print_message_queue(uint32_t y, uint32_t x)
 {
-  while (io_head) {
-    io_tail = io_head;
+  char buf[sizeof (io_msg[0].msg)];
+  io_message_t *m;
+
+  while (io_msg_shown != io_msg_end) {
+    m = &io_msg[io_msg_shown++ & (IO_MESSAGE_SLOTS - 1)];
     attron(COLOR_PAIR(COLOR_CYAN));
-    mvprintw(y, x, "%-80s", io_head->msg);
+    mvprintw(y, x, "%-80s", io_message_text(m, buf));
     attroff(COLOR_PAIR(COLOR_CYAN));
-    io_head = io_head->next;
-    if (io_head) {
+    if (io_msg_shown != io_msg_end) {
       attron(COLOR_PAIR(COLOR_CYAN));
       mvprintw(y, x + 70, "%10s", " --more-- ");
       attroff(COLOR_PAIR(COLOR_CYAN));
       refresh();
-      getch();
+      io_getch();
     }
-    free(io_tail);
   }
-  io_tail = NULL;
 }
 
 /**************************************************************************
@@ -106,101 +261,199 @@ static void io_print_message_queue(uint32_t y, uint32_t x)
  **************************************************************************/
 static int compare_trainer_distance(const void *v1, const void *v2)
 {
-  const character *const *c1 = (const character * const *) v1;
-  const character *const *c2 = (const character * const *) v2;
+  const npc *n1 = *(const npc * const *) v1;
+  const npc *n2 = *(const npc * const *) v2;
+  const int16_t *p1 = world.cur_map->npcs.pos[n1->slot];
+  const int16_t *p2 = world.cur_map->npcs.pos[n2->slot];
 
-  return (world.rival_dist[(*c1)->pos[dim_y]][(*c1)->pos[dim_x]] -
-          world.rival_dist[(*c2)->pos[dim_y]][(*c2)->pos[dim_x]]);
+  return (world.rival_dist[p1[dim_y]][p1[dim_x]] -
+          world.rival_dist[p2[dim_y]][p2[dim_x]]);
 }
 
-static character *io_nearest_visible_trainer()
+/* Trainer slot of the closest trainer by the same measure as      *
+ * compare_trainer_distance(), or -1 if there are none.  Only the  *
+ * nearest is wanted, so one pass over the map's trainers does it; *
+ * there's no need to sort them all.                               */
+static int32_t io_nearest_visible_trainer()
 {
-  character **c, *n;
-  uint32_t x, y, count;
+  pair_t *pos = world.cur_map->npcs.pos;
+  int32_t n, i;
+
+  for (n = -1, i = 0; i < world.cur_map->num_trainers; i++) {
+    if (n < 0 ||
+        (world.rival_dist[pos[i][dim_y]][pos[i][dim_x]] <
+         world.rival_dist[pos[n][dim_y]][pos[n][dim_x]])) {
+      n = i;
+    }
+  }
 
-  c = (character **) malloc(world.cur_map->num_trainers * sizeof (*c));
+  return n;
+}
 
-  /* Get a linear list of trainers */
-  for (count = 0, y = 1; y < MAP_Y - 1; y++) {
-    for (x = 1; x < MAP_X - 1; x++) {
-      if (world.cur_map->cmap[y][x] && world.cur_map->cmap[y][x] !=
-          &world.pc) {
-        c[count++] = world.cur_map->cmap[y][x];
-      }
-    }
+/* Formats a duration in at most 6 characters */
+static const char *io_format_ns(char *buf, uint64_t ns)
+{
+  if (ns < 10000) {
+    sprintf(buf, "%lluns", (unsigned long long) ns);
+  } else if (ns < 10000000) {
+    sprintf(buf, "%lluus", (unsigned long long) ns / 1000);
+  } else if (ns < 10000000000ULL) {
+    sprintf(buf, "%llums", (unsigned long long) ns / 1000000);
+  } else {
+    sprintf(buf, "%llus", (unsigned long long) ns / 1000000000);
   }
 
-  /* Sort it by distance from PC */
-  qsort(c, count, sizeof (*c), compare_trainer_distance);
+  return buf;
+}
 
-  n = c[0];
+/* Where the stats overlay goes; it fills the top right of the map.  *
+ * IO_STATS_WIDTH is what each row's format below prints, and the    *
+ * overlay ends at the map's right edge, so a row never wraps.       */
+#define IO_STATS_WIDTH 48
+#define IO_STATS_X     (MAP_X - IO_STATS_WIDTH)
 
-  free(c);
+static void io_display_stats()
+{
+  stats_summary_t s;
+  char p50[8], p99[8], max[8];
+  int i;
+
+  attron(COLOR_PAIR(COLOR_CYAN));
+  mvprintw(1, IO_STATS_X, " %-17s %7s %6s %6s %6s ",
+           "phase", "count", "p50", "p99", "max");
+  for (i = 0; i < num_stats_phases; i++) {
+    stats_summarize((stats_phase_t) i, &s);
+    mvprintw(i + 2, IO_STATS_X, " %-17s %7llu %6s %6s %6s ",
+             stats_phase_name[i], (unsigned long long) s.count,
+             io_format_ns(p50, s.p50), io_format_ns(p99, s.p99),
+             io_format_ns(max, s.max));
+  }
+  attroff(COLOR_PAIR(COLOR_CYAN));
+}
 
-  return n;
+/* What io_display() last drew in each map cell, so it only has to send *
+ * the cells that changed.  The map is redrawn from scratch whenever    *
+ * something else has drawn over it; io_clear() takes care of that.     */
+typedef struct io_cell {
+  char glyph;
+  uint8_t color; /* Color pair, 0 for none */
+} io_cell_t;
+
+static io_cell_t io_frame[MAP_Y][MAP_X];
+static int io_frame_valid;
+
+/* Use instead of clear(), so the next io_display() repaints the map. */
+static void io_clear()
+{
+  clear();
+  io_frame_valid = 0;
 }
 
-void io_display()
+static void io_map_cell(uint32_t y, uint32_t x, io_cell_t *cell)
 {
-  uint32_t y, x;
-  character *c;
+  cell->color = 0;
 
-  clear();
-  for (y = 0; y < MAP_Y; y++) {
-    for (x = 0; x < MAP_X; x++) {
-      if (world.cur_map->cmap[y][x]) {
-        mvaddch(y + 1, x, world.cur_map->cmap[y][x]->symbol);
-      } else {
-        switch (world.cur_map->map[y][x]) {
-        case ter_boulder:
-        case ter_mountain:
-          attron(COLOR_PAIR(COLOR_MAGENTA));
-          mvaddch(y + 1, x, '%');
-          attroff(COLOR_PAIR(COLOR_MAGENTA));
-          break;
-        case ter_tree:
-        case ter_forest:
-          attron(COLOR_PAIR(COLOR_GREEN));
-          mvaddch(y + 1, x, '^');
-          attroff(COLOR_PAIR(COLOR_GREEN));
-          break;
-        case ter_path:
-        case ter_exit:
-          attron(COLOR_PAIR(COLOR_YELLOW));
-          mvaddch(y + 1, x, '#');
-          attroff(COLOR_PAIR(COLOR_YELLOW));
-          break;
-        case ter_mart:
-          attron(COLOR_PAIR(COLOR_BLUE));
-          mvaddch(y + 1, x, 'M');
-          attroff(COLOR_PAIR(COLOR_BLUE));
-          break;
-        case ter_center:
-          attron(COLOR_PAIR(COLOR_RED));
-          mvaddch(y + 1, x, 'C');
-          attroff(COLOR_PAIR(COLOR_RED));
-          break;
-        case ter_grass:
-          attron(COLOR_PAIR(COLOR_GREEN));
-          mvaddch(y + 1, x, ':');
-          attroff(COLOR_PAIR(COLOR_GREEN));
-          break;
-        case ter_clearing:
-          attron(COLOR_PAIR(COLOR_GREEN));
-          mvaddch(y + 1, x, '.');
-          attroff(COLOR_PAIR(COLOR_GREEN));
-          break;
-        default:
+  if (world.cur_map->cmap[y][x]) {
+    cell->glyph = world.cur_map->cmap[y][x]->symbol;
+    return;
+  }
+
+  switch (world.cur_map->map[y][x]) {
+  case ter_boulder:
+  case ter_mountain:
+    cell->glyph = '%';
+    cell->color = COLOR_MAGENTA;
+    break;
+  case ter_tree:
+  case ter_forest:
+    cell->glyph = '^';
+    cell->color = COLOR_GREEN;
+    break;
+  case ter_path:
+  case ter_exit:
+    cell->glyph = '#';
+    cell->color = COLOR_YELLOW;
+    break;
+  case ter_mart:
+    cell->glyph = 'M';
+    cell->color = COLOR_BLUE;
+    break;
+  case ter_center:
+    cell->glyph = 'C';
+    cell->color = COLOR_RED;
+    break;
+  case ter_grass:
+    cell->glyph = ':';
+    cell->color = COLOR_GREEN;
+    break;
+  case ter_clearing:
+    cell->glyph = '.';
+    cell->color = COLOR_GREEN;
+    break;
+  default:
  /* Use zero as an error symbol, since it stands out somewhat, and it's *
   * not otherwise used.                                                 */
-          attron(COLOR_PAIR(COLOR_CYAN));
-          mvaddch(y + 1, x, '0');
-          attroff(COLOR_PAIR(COLOR_CYAN)); 
-       }
-      }
+    cell->glyph = '0';
+    cell->color = COLOR_CYAN;
+  }
+}
+
+/* Sends the cells of map row y that differ from the last frame, one *
+ * string per run of changed cells that share a color.               */
+static void io_display_row(uint32_t y)
+{
+  io_cell_t cell[MAP_X];
+  char run[MAP_X + 1];
+  uint32_t x, start, len;
+
+  for (x = 0; x < MAP_X; x++) {
+    io_map_cell(y, x, &cell[x]);
+  }
+
+  for (x = 0; x < MAP_X; ) {
+    if (io_frame_valid &&
+        cell[x].glyph == io_frame[y][x].glyph &&
+        cell[x].color == io_frame[y][x].color) {
+      x++;
+      continue;
+    }
+    for (start = x, len = 0;
+         x < MAP_X && cell[x].color == cell[start].color &&
+           (!io_frame_valid ||
+            cell[x].glyph != io_frame[y][x].glyph ||
+            cell[x].color != io_frame[y][x].color);
+         x++) {
+      run[len++] = cell[x].glyph;
+      io_frame[y][x] = cell[x];
+    }
+    run[len] = '\0';
+    if (cell[start].color) {
+      attron(COLOR_PAIR(cell[start].color));
+    }
+    mvaddnstr(y + 1, start, run, len);
+    if (cell[start].color) {
+      attroff(COLOR_PAIR(cell[start].color));
     }
   }
+}
 
+static void io_draw()
+{
+  uint32_t y, x;
+  int32_t i;
+  int16_t *pos;
+  stats_timer timer(stats_render);
+
+  for (y = 0; y < MAP_Y; y++) {
+    io_display_row(y);
+  }
+  io_frame_valid = 1;
+
+  /* The message line and status lines are short; just rewrite them. */
+  move(0, 0);
+  clrtoeol();
+  move(22, 0);
+  clrtobot();
   mvprintw(23, 1, "PC position is (%2d,%2d) on map %d%cx%d%c.",
            world.pc.pos[dim_x],
            world.pc.pos[dim_y],
@@ -211,15 +464,16 @@ void io_display()
   mvprintw(22, 1, "%d known %s.", world.cur_map->num_trainers,
            world.cur_map->num_trainers > 1 ? "trainers" : "trainer");
   mvprintw(22, 30, "Nearest visible trainer: ");
-  if ((c = io_nearest_visible_trainer())) {
+  if ((i = io_nearest_visible_trainer()) >= 0) {
+    pos = world.cur_map->npcs.pos[i];
     attron(COLOR_PAIR(COLOR_RED));
     mvprintw(22, 55, "%c at %d %c by %d %c.",
-             c->symbol,
-             abs(c->pos[dim_y] - world.pc.pos[dim_y]),
-             ((c->pos[dim_y] - world.pc.pos[dim_y]) <= 0 ?
+             world.cur_map->trainer[i]->symbol,
+             abs(pos[dim_y] - world.pc.pos[dim_y]),
+             ((pos[dim_y] - world.pc.pos[dim_y]) <= 0 ?
               'N' : 'S'),
-             abs(c->pos[dim_x] - world.pc.pos[dim_x]),
-             ((c->pos[dim_x] - world.pc.pos[dim_x]) <= 0 ?
+             abs(pos[dim_x] - world.pc.pos[dim_x]),
+             ((pos[dim_x] - world.pc.pos[dim_x]) <= 0 ?
               'W' : 'E'));
     attroff(COLOR_PAIR(COLOR_RED));
   } else {
@@ -228,11 +482,92 @@ void io_display()
     attroff(COLOR_PAIR(COLOR_BLUE));
   }
 
+  if (io_show_stats) {
+    io_display_stats();
+    /* The overlay hides those map cells; redraw them when it's gone */
+    for (y = 0; y <= num_stats_phases; y++) {
+      for (x = IO_STATS_X; x < IO_STATS_X + IO_STATS_WIDTH; x++) {
+        io_frame[y][x].glyph = 0;
+      }
+    }
+  }
+
   io_print_message_queue(0, 0);
 
   refresh();
 }
 
+/* Nanoseconds between frames; 0 draws every frame. */
+static uint64_t io_frame_interval = 1000000000ULL / IO_DEFAULT_FPS;
+static uint64_t io_last_frame;
+
+void io_set_frame_rate(uint32_t fps)
+{
+  io_frame_interval = fps ? 1000000000ULL / fps : 0;
+}
+
+/* Returns non-zero if there is input waiting, giving it up to wait_ms *
+ * milliseconds to arrive.  A replay always has its next key ready.    */
+static int io_input_pending(int wait_ms)
+{
+  if (replay_playing()) {
+    return 1;
+  }
+
+#ifdef HEADLESS
+  return 1;
+#else
+  stats_idle idle;
+  int key;
+
+  timeout(wait_ms);
+  key = getch();
+  timeout(-1);
+
+  if (key == ERR) {
+    return 0;
+  }
+  ungetch(key);
+
+  return 1;
+#endif
+}
+
+/**************************************************************************
+ * Called before every map input.  Drawing a frame the player will never  *
+ * see is wasted work, so while keys are queued up (held down, pasted, or *
+ * replayed) the frame is skipped and the next key is handled right away. *
+ * Frames are drawn at most io_frame_interval apart; a frame skipped      *
+ * while keys were queued is made up once the queue runs dry, after any   *
+ * remaining part of the interval, and an overdue frame is drawn even     *
+ * with keys queued so a long replay still shows progress.  Messages      *
+ * always get a frame, since they wait at --more-- for the player.        *
+ **************************************************************************/
+void io_display()
+{
+  uint64_t since;
+  int wait_ms;
+
+#ifdef HEADLESS
+  /* Nothing to draw, but the messages still have to be dismissed, so *
+   * the PC presses a key at each --more-- just like a player would.  *
+   * That keeps the input stream the same as the curses build's.      */
+  io_print_message_queue(0, 0);
+
+  return;
+#endif
+
+  if (io_msg_shown == io_msg_end && (since = stats_now() - io_last_frame) < io_frame_interval) {
+    wait_ms = (io_frame_interval - since + 999999) / 1000000;
+    if (io_input_pending(0) || io_input_pending(wait_ms)) {
+      return;
+    }
+  }
+
+  io_draw();
+  io_last_frame = stats_now();
+}
+
 uint32_t io_teleport_pc(pair_t dest)
 {
   /* Just for fun. And debugging.  Mostly debugging. */
@@ -240,7 +575,7 @@ uint32_t io_teleport_pc(pair_t dest)
   do {
     dest[dim_x] = rand_range(1, MAP_X - 2);
     dest[dim_y] = rand_range(1, MAP_Y - 2);
-  } while (world.cur_map->cmap[dest[dim_y]][dest[dim_x]]                  ||
+  } while (map_occupied(world.cur_map, dest[dim_y], dest[dim_x])          ||
            move_cost[char_pc][world.cur_map->map[dest[dim_y]]
                                                 [dest[dim_x]]] == INT_MAX ||
            world.rival_dist[dest[dim_y]][dest[dim_x]] < 0);
@@ -259,7 +594,7 @@ static void io_scroll_trainer_list(char (*s)[40], uint32_t count)
     for (i = 0; i < 13; i++) {
       mvprintw(i + 6, 19, " %-40s ", s[i + offset]);
     }
-    switch (getch()) {
+    switch (io_getch()) {
     case KEY_UP:
       if (offset) {
         offset--;
@@ -281,6 +616,7 @@ static void io_list_trainers_display(npc **c,
                                      uint32_t count)
 {
   uint32_t i;
+  int16_t *pos;
   char (*s)[40]; /* pointer to array of 40 char */
 
   s = (char (*)[40]) malloc(count * sizeof (*s));
@@ -292,14 +628,15 @@ static void io_list_trainers_display(npc **c,
   mvprintw(5, 19, " %-40s ", "");
 
   for (i = 0; i < count; i++) {
+    pos = world.cur_map->npcs.pos[c[i]->slot];
     snprintf(s[i], 40, "%16s %c: %2d %s by %2d %s",
-             char_type_name[c[i]->ctype],
+             char_type_name[world.cur_map->npcs.ctype[c[i]->slot]],
              c[i]->symbol,
-             abs(c[i]->pos[dim_y] - world.pc.pos[dim_y]),
-             ((c[i]->pos[dim_y] - world.pc.pos[dim_y]) <= 0 ?
+             abs(pos[dim_y] - world.pc.pos[dim_y]),
+             ((pos[dim_y] - world.pc.pos[dim_y]) <= 0 ?
               "North" : "South"),
-             abs(c[i]->pos[dim_x] - world.pc.pos[dim_x]),
-             ((c[i]->pos[dim_x] - world.pc.pos[dim_x]) <= 0 ?
+             abs(pos[dim_x] - world.pc.pos[dim_x]),
+             ((pos[dim_x] - world.pc.pos[dim_x]) <= 0 ?
               "West" : "East"));
     if (count <= 13) {
       /* Handle the non-scrolling case right here. *
@@ -311,7 +648,7 @@ static void io_list_trainers_display(npc **c,
   if (count <= 13) {
     mvprintw(count + 6, 19, " %-40s ", "");
     mvprintw(count + 7, 19, " %-40s ", "Hit escape to continue.");
-    while (getch() != 27 /* escape */)
+    while (io_getch() != 27 /* escape */)
       ;
   } else {
     mvprintw(19, 19, " %-40s ", "");
@@ -326,19 +663,11 @@ static void io_list_trainers_display(npc **c,
 static void io_list_trainers()
 {
   npc **c;
-  uint32_t x, y, count;
+  uint32_t count;
 
-  c = (npc **) malloc(world.cur_map->num_trainers * sizeof (*c));
-
-  /* Get a linear list of trainers */
-  for (count = 0, y = 1; y < MAP_Y - 1; y++) {
-    for (x = 1; x < MAP_X - 1; x++) {
-      if (world.cur_map->cmap[y][x] && world.cur_map->cmap[y][x] !=
-          &world.pc) {
-        c[count++] = (npc *) world.cur_map->cmap[y][x];
-      }
-    }
-  }
+  count = world.cur_map->num_trainers;
+  c = (npc **) malloc(count * sizeof (*c));
+  memcpy(c, world.cur_map->trainer, count * sizeof (*c));
 
   /* Sort it by distance from PC */
   qsort(c, count, sizeof (*c), compare_trainer_distance);
@@ -347,10 +676,57 @@ static void io_list_trainers()
   io_list_trainers_display(c, count);
   free(c);
 
-  /* And redraw the map */
+  /* And redraw the map, which the list was drawn over */
+  io_frame_valid = 0;
   io_display();
 }
 
+/* Rows of history shown at once, between the title and the help line */
+#define IO_HISTORY_ROWS 21
+
+/* Scrolls through the messages already shown, newest at the bottom. */
+static void io_message_history()
+{
+  char buf[sizeof (io_msg[0].msg)];
+  uint32_t first, count, offset;
+  uint32_t i;
+
+  first = (io_msg_end > IO_MESSAGE_SLOTS ? io_msg_end - IO_MESSAGE_SLOTS : 0);
+  count = io_msg_shown - first;
+  offset = count > IO_HISTORY_ROWS ? count - IO_HISTORY_ROWS : 0;
+
+  io_clear();
+  mvprintw(0, 0, "Message history (last %u):", count);
+  mvprintw(23, 0, "%s", count > IO_HISTORY_ROWS ?
+           "Arrows to scroll, escape to continue." : "Hit escape to continue.");
+
+  while (1) {
+    for (i = 0; i < IO_HISTORY_ROWS && i < count; i++) {
+      move(i + 1, 0);
+      clrtoeol();
+      mvprintw(i + 1, 0, "%s",
+               io_message_text(&io_msg[(first + offset + i) &
+                                       (IO_MESSAGE_SLOTS - 1)], buf));
+    }
+    switch (io_getch()) {
+    case KEY_UP:
+      if (offset) {
+        offset--;
+      }
+      break;
+    case KEY_DOWN:
+      if (offset + IO_HISTORY_ROWS < count) {
+        offset++;
+      }
+      break;
+    case 27:
+      io_clear();
+      io_display();
+      return;
+    }
+  }
+}
+
 void io_pokemart()
 {
   // restore all supplies
@@ -360,7 +736,7 @@ void io_pokemart()
 
   mvprintw(0, 0, "Welcome to the Pokemart.  Could I interest you in some Pokeballs?");
   refresh();
-  getch();
+  io_getch();
 }
 
 void io_pokemon_center()
@@ -372,7 +748,7 @@ void io_pokemon_center()
 
   mvprintw(0, 0, "Welcome to the Pokemon Center.  How can Nurse Joy assist you?");
   refresh();
-  getch();
+  io_getch();
 }
 
 void generate_trainer_pokemon_party(character *trainer) {
@@ -410,254 +786,90 @@ void generate_trainer_pokemon_party(character *trainer) {
 
 }
 
-void switch_pokemon(character *trainer, int pos) {
-  // create new vector to pushback new party
-  std::vector<pokemon> new_pokemon_party;
-
-  for (int i = 0; i < (int) trainer->pokemon_party.size(); i++) {
-    if (i == 0) {
-      new_pokemon_party.push_back(trainer->pokemon_party[pos]);
-    }
-    else if (i == pos) {
-      new_pokemon_party.push_back(trainer->pokemon_party[0]);
-    }
-    else {
-      new_pokemon_party.push_back(trainer->pokemon_party[i]);
-    }
-  }
-
-  // swap two vectors
-  trainer->pokemon_party.swap(new_pokemon_party);
-}
-
-// returns 0 if move hits, 1 if move misses
-int do_battle_move(pokemon *attacker, pokemon *defender, int move_index) {
-  int level, power, attack, defense, random;
-  float critical, stab, type;
-
-  if (rand() % 100 >= moves[move_index].accuracy) {
-    return 1;
-  }
-
-  level = attacker->get_level();
-  power = moves[move_index].power;
-  attack = attacker->get_atk();
-  defense = defender->get_def();
-  critical = (rand_range(0, 255) < species[attacker->get_pokemon_species_index()].base_stat[stat_speed] / 2) ? 1.5 : 1.0;
-  random = rand_range(85, 100);
-  type = 1.0;
-
-  for (int i = 0; i < attacker->get_num_types(); i++) {
-    if (attacker->get_type_id(i) == moves[move_index].type_id) {
-      stab = 1.5;
-    }
-  }
-  if (stab != 1.5) { stab = 1.0; }
-
-  float move_damage_float = ((((2 * level) / 5 + 2) * power * (attack / defense)) / 50 + 2) * critical * random * stab * type;
-  int move_damage = ((int) std::round(move_damage_float)) / 100;
-
-  defender->set_hp(std::max(defender->get_hp() - move_damage, 0));
-
-  return 0;
-}
-
-int check_pokemon_party_for_valid_pokemon(character *d) {
-  if (d->pokemon_party[0].get_hp() == 0) {
-    // find another pokemon to switch to (if there is one)
-    for (int i = 0; i < (int) d->pokemon_party.size(); i++) {
-      if (d->pokemon_party[i].get_hp() > 0) {
-        switch_pokemon(d, i);
-      }
-    }
+/* Shows side's line of the battle screen header */
+static void io_battle_hp(battle_side_t side, const battle_event_t *e,
+                         int wild)
+{
+  const char *name = e->db->species[e->species].identifier;
 
-    // check if there was a valid pokemon to switch to, return 1 if there was not
-    if (d->pokemon_party[0].get_hp() == 0) {
-      return 1;
-    }
+  if (side == battle_pc) {
+    mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", name, e->hp);
+  } else if (wild) {
+    mvprintw(1, 0, "Wild %s, hp: %d", name, e->hp);
+  } else {
+    mvprintw(1, 0, "Trainer's Current Pokemon: %s, hp: %d", name, e->hp);
   }
-
-  return 0;
+  clrtoeol();
 }
 
-int cmp_pokemon_move_priority(int i, pokemon *pc, pokemon *npc)
+/* Shows a round of a battle, one key press per step */
+static void io_battle_events(const battle_event_t *e, int n, int wild)
 {
-  if ((moves[pc->get_move_index(i)].priority - moves[npc->get_move_index(0)].priority) != 0) {
-    return (moves[pc->get_move_index(i)].priority - moves[npc->get_move_index(0)].priority);
-  }
-
-  return (pc->get_speed() - npc->get_speed());
-}
-
-// returns 1 if battle ends, returns 0 otherwise
-int io_do_battle_move(int pc_move_choice, npc *n) {
-  int move_cmp = cmp_pokemon_move_priority(pc_move_choice, &(world.pc.pokemon_party[0]), &(n->pokemon_party[0]));
-  
-  move(3, 0);
-  clrtobot();
-
-  if (move_cmp > 0) { // pc moves first
-    // pc move
-    mvprintw(3, 0, "%s used %s!", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_move(pc_move_choice));
-    getch();
-    if (do_battle_move(&(world.pc.pokemon_party[0]), &(n->pokemon_party[0]), world.pc.pokemon_party[0].get_move_index(pc_move_choice))) {
-      mvprintw(4, 0, "Missed!");
-    } else {
-      mvprintw(4, 0, "Hit!");
-    }
-    getch();
-    mvprintw(1, 0, "Trainer's Current Pokemon: %s, hp: %d", n->pokemon_party[0].get_species(), n->pokemon_party[0].get_hp());
-    clrtoeol();
-
-    // check npc for valid pokemon remaining
-    if (check_pokemon_party_for_valid_pokemon(n)) {
-      return 1;
-    }
-
-    // npc move
-    int rand_move = rand_range(0, n->pokemon_party[0].get_num_moves() - 1);
-    move(3, 0);
-    clrtobot();
-    mvprintw(3, 0, "%s used %s!", n->pokemon_party[0].get_species(), n->pokemon_party[0].get_move(rand_move));
-    getch();
-    if (do_battle_move(&(n->pokemon_party[0]), &(world.pc.pokemon_party[0]), n->pokemon_party[0].get_move_index(rand_move))) {
-      mvprintw(4, 0, "Missed!");
-    } else {
-      mvprintw(4, 0, "Hit!");
-    }
-    getch();
-    mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
-    clrtoeol();
+  int i;
 
-    // check pc for valid pokemon remaining
-    if (check_pokemon_party_for_valid_pokemon(&world.pc)) {
-      return 1;
-    }
-  } else if (move_cmp < 0) { // npc moves first
-    // npc move
-    int rand_move = rand_range(0, n->pokemon_party[0].get_num_moves() - 1);
-    mvprintw(3, 0, "%s used %s!", n->pokemon_party[0].get_species(), n->pokemon_party[0].get_move(rand_move));
-    getch();
-    if (do_battle_move(&(n->pokemon_party[0]), &(world.pc.pokemon_party[0]), n->pokemon_party[0].get_move_index(rand_move))) {
-      mvprintw(4, 0, "Missed!");
-    } else {
-      mvprintw(4, 0, "Hit!");
-    }
-    getch();
-    mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
-    clrtoeol();
-
-    // check pc for valid pokemon remaining
-    if (check_pokemon_party_for_valid_pokemon(&world.pc)) {
-      return 1;
-    }
-
-    // pc move
-    move(3, 0);
-    clrtobot();
-    mvprintw(3, 0, "%s used %s!", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_move(pc_move_choice));
-    getch();
-    if (do_battle_move(&(world.pc.pokemon_party[0]), &(n->pokemon_party[0]), world.pc.pokemon_party[0].get_move_index(pc_move_choice))) {
-      mvprintw(4, 0, "Missed!");
-    } else {
-      mvprintw(4, 0, "Hit!");
-    }
-    getch();
-    mvprintw(1, 0, "Trainer's Current Pokemon: %s, hp: %d", n->pokemon_party[0].get_species(), n->pokemon_party[0].get_hp());
-    clrtoeol();
-
-    // check npc for valid pokemon remaining
-    if (check_pokemon_party_for_valid_pokemon(n)) {
-      return 1;
-    }
-  } else { // randomly decide who moves first
-    if (rand_range(0,1) == 1) { // pc moves first
-      // pc move
-      mvprintw(3, 0, "%s used %s!", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_move(pc_move_choice));
-      getch();
-      if (do_battle_move(&(world.pc.pokemon_party[0]), &(n->pokemon_party[0]), world.pc.pokemon_party[0].get_move_index(pc_move_choice))) {
-        mvprintw(4, 0, "Missed!");
-      } else {
-        mvprintw(4, 0, "Hit!");
-      }
-      getch();
-      mvprintw(1, 0, "Trainer's Current Pokemon: %s, hp: %d", n->pokemon_party[0].get_species(), n->pokemon_party[0].get_hp());
-      clrtoeol();
-
-      // check npc for valid pokemon remaining
-      if (check_pokemon_party_for_valid_pokemon(n)) {
-        return 1;
-      }
-
-      // npc move
-      int rand_move = rand_range(0, n->pokemon_party[0].get_num_moves() - 1);
+  for (i = 0; i < n; i++) {
+    switch (e[i].type) {
+    case battle_event_use:
       move(3, 0);
       clrtobot();
-      mvprintw(3, 0, "%s used %s!", n->pokemon_party[0].get_species(), n->pokemon_party[0].get_move(rand_move));
-      getch();
-      if (do_battle_move(&(n->pokemon_party[0]), &(world.pc.pokemon_party[0]), n->pokemon_party[0].get_move_index(rand_move))) {
-        mvprintw(4, 0, "Missed!");
-      } else {
-        mvprintw(4, 0, "Hit!");
-      }
-      getch();
-      mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
-      clrtoeol();
-
-      // check pc for valid pokemon remaining
-      if (check_pokemon_party_for_valid_pokemon(&world.pc)) {
-        return 1;
-      }
-    } else { // npc goes first
-      // npc move
-      int rand_move = rand_range(0, n->pokemon_party[0].get_num_moves() - 1);
-      mvprintw(3, 0, "%s used %s!", n->pokemon_party[0].get_species(), n->pokemon_party[0].get_move(rand_move));
-      getch();
-      if (do_battle_move(&(n->pokemon_party[0]), &(world.pc.pokemon_party[0]), n->pokemon_party[0].get_move_index(rand_move))) {
-        mvprintw(4, 0, "Missed!");
-      } else {
-        mvprintw(4, 0, "Hit!");
-      }
-      getch();
-      mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
-      clrtoeol();
-
-      // check pc for valid pokemon remaining
-      if (check_pokemon_party_for_valid_pokemon(&world.pc)) {
-        return 1;
-      }
-
-      // pc move
-      move(3, 0);
-      clrtobot();
-      mvprintw(3, 0, "%s used %s!", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_move(pc_move_choice));
-      getch();
-      if (do_battle_move(&(world.pc.pokemon_party[0]), &(n->pokemon_party[0]), world.pc.pokemon_party[0].get_move_index(pc_move_choice))) {
-        mvprintw(4, 0, "Missed!");
-      } else {
-        mvprintw(4, 0, "Hit!");
-      }
-      getch();
-      mvprintw(1, 0, "Trainer's Current Pokemon: %s, hp: %d", n->pokemon_party[0].get_species(), n->pokemon_party[0].get_hp());
-      clrtoeol();
-
-      // check npc for valid pokemon remaining
-      if (check_pokemon_party_for_valid_pokemon(n)) {
-        return 1;
-      }
+      mvprintw(3, 0, "%s used %s!",
+               e[i].db->species[e[i].species].identifier,
+               e[i].db->moves[e[i].move].identifier);
+      io_getch();
+      break;
+    case battle_event_hit:
+    case battle_event_miss:
+      mvprintw(4, 0, e[i].type == battle_event_hit ? "Hit!" : "Missed!");
+      io_getch();
+      io_battle_hp(e[i].side == battle_pc ? battle_foe : battle_pc,
+                   e + i, wild);
+      break;
+    case battle_event_potion:
+    case battle_event_revive:
+      io_battle_hp(battle_pc, e + i, wild);
+      mvprintw(10, 0, e[i].type == battle_event_potion ?
+               "You used a potion." : "You used a revive.");
+      io_getch();
+      break;
+    case battle_event_fled:
+      io_clear();
+      mvprintw(0, 0, "You fled.");
+      io_getch();
+      break;
+    case battle_event_trapped:
+      mvprintw(9, 0, "Could not escape!");
+      io_getch();
+      break;
+    case battle_event_over:
+      break;
     }
-
   }
+}
 
-  refresh();
+/* Plays a round of b with the PC doing pc and the foe fighting, and *
+ * shows it.  Returns 1 if the battle is over.  Trainers use their   *
+ * best move (looking ahead with --battle-ai); wild pokemon flail    *
+ * about at random.                                                  */
+static int io_battle_round(battle_t *b, battle_action_t pc, int wild)
+{
+  battle_event_t event[BATTLE_MAX_EVENTS];
+  battle_action_t foe;
+  int n;
 
-  return 0;
+  foe.type = battle_action_fight;
+  foe.index = wild ? BATTLE_RANDOM_MOVE : battle_ai_move(b, battle_foe);
+  n = battle_step(b, pc, foe, NULL, event);
+  io_battle_events(event, n, wild);
+
+  return b->over;
 }
 
 void io_battle(character *aggressor, character *defender)
 {
   int key;
   bool is_battle_over, turn_not_consumed, go_back;
+  battle_t b;
+  battle_action_t action;
 
   npc *n = (npc *) ((aggressor == &world.pc) ? defender : aggressor);
 
@@ -665,9 +877,18 @@ void io_battle(character *aggressor, character *defender)
     generate_trainer_pokemon_party(n);
   }
 
+  battle_init(&b, world.pc.pokemon_party.data(), world.pc.pokemon_party.size(),
+              n->pokemon_party.data(), n->pokemon_party.size(),
+              world.pc.bag_items);
+  action.type = battle_action_fight;
+  action.index = 0;
+
+  io_in_battle = 1;
   is_battle_over = false;
   do {
-    clear();
+    trace_scope trace("trainer_battle_turn", "battle");
+
+    io_clear();
     mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
     mvprintw(1, 0, "Trainer's Current Pokemon: %s, hp: %d", n->pokemon_party[0].get_species(), n->pokemon_party[0].get_hp());
     
@@ -676,7 +897,9 @@ void io_battle(character *aggressor, character *defender)
     mvprintw(5, 0, "b: Bag");
     mvprintw(6, 0, "p: Pokemon");
 
-    switch (key = getch()) {
+    // any other key - do nothing, turn not consumed
+    go_back = 1;
+    switch (key = io_getch()) {
     case 'f':
       // TODO: fight - print pokemon moves as options (lines 1-4)
       move(4, 0);
@@ -688,32 +911,17 @@ void io_battle(character *aggressor, character *defender)
 
       mvprintw(10, 0, "Press 'esc' to go back");
       
-      // simulate move sequence with npc move
       go_back = 0;
       turn_not_consumed = 1;
       do {
-        switch (key = getch()) {
+        switch (key = io_getch()) {
           case '1':
-            if (world.pc.pokemon_party[0].get_num_moves() >= 1) {
-              is_battle_over = io_do_battle_move(0, n);
-              turn_not_consumed = 0;
-            }
-            break;
           case '2':
-            if (world.pc.pokemon_party[0].get_num_moves() >= 2) {
-              is_battle_over = io_do_battle_move(1, n);
-              turn_not_consumed = 0;
-            }
-            break;
           case '3':
-            if (world.pc.pokemon_party[0].get_num_moves() >= 3) {
-              is_battle_over = io_do_battle_move(2, n);
-              turn_not_consumed = 0;
-            }
-            break;
           case '4':
-            if (world.pc.pokemon_party[0].get_num_moves() >= 4) {
-              is_battle_over = io_do_battle_move(3, n);
+            if (world.pc.pokemon_party[0].get_num_moves() >= key - '0') {
+              action.type = battle_action_fight;
+              action.index = key - '1';
               turn_not_consumed = 0;
             }
             break;
@@ -739,36 +947,20 @@ void io_battle(character *aggressor, character *defender)
       turn_not_consumed = 1;
       go_back = 0;
       do {
-        switch (key = getch()) {
+        switch (key = io_getch()) {
         case '1': //potion
           if (world.pc.pokemon_party[0].get_hp() != 0                                      && 
               world.pc.pokemon_party[0].get_hp() != world.pc.pokemon_party[0].get_max_hp() &&
               world.pc.bag_items[item_potion] != 0) {
-                //add hp and decrement item
-                world.pc.pokemon_party[0].set_hp(std::min(world.pc.pokemon_party[0].get_max_hp(), world.pc.pokemon_party[0].get_hp() + 20));
-                world.pc.bag_items[item_potion]--;
-
-                mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
-                clrtoeol();
-                mvprintw(10, 0, "You used a potion.");
-                getch();
-
-                turn_not_consumed = 0;
+            action.type = battle_action_potion;
+            turn_not_consumed = 0;
           }
           break;
         case '2': //revive
           if (world.pc.pokemon_party[0].get_hp() == 0 && 
               world.pc.bag_items[item_revive] != 0) {
-                //add hp and decrement item
-                world.pc.pokemon_party[0].set_hp(world.pc.pokemon_party[0].get_max_hp() / 2);
-                world.pc.bag_items[item_revive]--;
-
-                mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
-                clrtoeol();
-                mvprintw(10, 0, "You used a revive.");
-                getch();
-
-                turn_not_consumed = 0;
+            action.type = battle_action_revive;
+            turn_not_consumed = 0;
           }
           break;
         case 27: //esc
@@ -779,27 +971,6 @@ void io_battle(character *aggressor, character *defender)
           break;
         }
       } while (turn_not_consumed && !go_back);
-
-      if (!go_back) {
-        // npc move
-        int rand_move = rand_range(0, n->pokemon_party[0].get_num_moves() - 1);
-        move(3, 0);
-        clrtobot();
-        mvprintw(3, 0, "%s used %s!", n->pokemon_party[0].get_species(), n->pokemon_party[0].get_move(rand_move));
-        getch();
-        if (do_battle_move(&(n->pokemon_party[0]), &(world.pc.pokemon_party[0]), n->pokemon_party[0].get_move_index(rand_move))) {
-          mvprintw(4, 0, "Missed!");
-        } else {
-          mvprintw(4, 0, "Hit!");
-        }
-        getch();
-        mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
-        clrtoeol();
-
-        // check pc for valid pokemon remaining
-        is_battle_over = check_pokemon_party_for_valid_pokemon(&world.pc);
-      }
-
       break;
     case 'p':
       // pokemon - print pokemon with hp (lines 4-9)
@@ -815,39 +986,16 @@ void io_battle(character *aggressor, character *defender)
       go_back = 0;
       turn_not_consumed = 1;
       do {
-        switch (key = getch()) {
+        switch (key = io_getch()) {
         case '2':
-          if (world.pc.pokemon_party.size() >= 2 &&
-              world.pc.pokemon_party[1].get_hp() > 0) {
-            switch_pokemon(&world.pc, 1);
-            turn_not_consumed = 0;
-          }
-          break;
         case '3':
-          if (world.pc.pokemon_party.size() >= 3 &&
-              world.pc.pokemon_party[2].get_hp() > 0) {
-            switch_pokemon(&world.pc, 2);
-            turn_not_consumed = 0;
-          }
-          break;
         case '4':
-          if (world.pc.pokemon_party.size() >= 4 &&
-              world.pc.pokemon_party[3].get_hp() > 0) {
-            switch_pokemon(&world.pc, 3);
-            turn_not_consumed = 0;
-          }
-          break;
         case '5':
-          if (world.pc.pokemon_party.size() >= 5 &&
-              world.pc.pokemon_party[4].get_hp() > 0) {
-            switch_pokemon(&world.pc, 4);
-            turn_not_consumed = 0;
-          }
-          break;
         case '6':
-          if (world.pc.pokemon_party.size() >= 6 &&
-              world.pc.pokemon_party[5].get_hp() > 0) {
-            switch_pokemon(&world.pc, 5);
+          if ((int) world.pc.pokemon_party.size() >= key - '0' &&
+              world.pc.pokemon_party[key - '1'].get_hp() > 0) {
+            action.type = battle_action_switch;
+            action.index = key - '1';
             turn_not_consumed = 0;
           }
           break;
@@ -859,52 +1007,36 @@ void io_battle(character *aggressor, character *defender)
           break;
         }
       } while (turn_not_consumed && !go_back);
-
-      if (!go_back) {
-        // npc move
-        int rand_move = rand_range(0, n->pokemon_party[0].get_num_moves() - 1);
-        move(3, 0);
-        clrtobot();
-        mvprintw(3, 0, "%s used %s!", n->pokemon_party[0].get_species(), n->pokemon_party[0].get_move(rand_move));
-        getch();
-        if (do_battle_move(&(n->pokemon_party[0]), &(world.pc.pokemon_party[0]), n->pokemon_party[0].get_move_index(rand_move))) {
-          mvprintw(4, 0, "Missed!");
-        } else {
-          mvprintw(4, 0, "Hit!");
-        }
-        getch();
-        mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
-        clrtoeol();
-
-        // check pc for valid pokemon remaining
-        is_battle_over = check_pokemon_party_for_valid_pokemon(&world.pc);
-      }
-
-      break;
-    default:
-      // any other key - do nothing, turn not consumed
       break;
     }
 
+    if (!go_back) {
+      is_battle_over = io_battle_round(&b, action, 0);
+    }
+
     refresh();
   } while (!is_battle_over);
 
-  clear();
+  io_clear();
   if (world.pc.pokemon_party[0].get_hp() == 0) {
     mvprintw(0, 0, "You were defeated! Go to a Pokecenter to restore your pokemon to full health.");
   } else {
     mvprintw(0, 0, "You defeated the opposing trainer!");
   }
-  getch();
+  io_getch();
+  io_in_battle = 0;
 
-  n->defeated = 1;
-  if (n->ctype == char_hiker || n->ctype == char_rival) {
-    n->mtype = move_wander;
+  world.cur_map->npcs.defeated[n->slot] = 1;
+  if (world.cur_map->npcs.ctype[n->slot] == char_hiker ||
+      world.cur_map->npcs.ctype[n->slot] == char_rival) {
+    world.cur_map->npcs.mtype[n->slot] = move_wander;
   }
 }
 
 uint32_t move_pc_dir(uint32_t input, pair_t dest)
 {
+  npc *n;
+
   dest[dim_y] = world.pc.pos[dim_y];
   dest[dim_x] = world.pc.pos[dim_x];
 
@@ -951,14 +1083,14 @@ uint32_t move_pc_dir(uint32_t input, pair_t dest)
     break;
   }
 
-  if (world.cur_map->cmap[dest[dim_y]][dest[dim_x]]) {
-    if (dynamic_cast<npc *>(world.cur_map->cmap[dest[dim_y]][dest[dim_x]]) &&
-        ((npc *) world.cur_map->cmap[dest[dim_y]][dest[dim_x]])->defeated) {
+  if (world.cur_map->cmap[dest[dim_y]][dest[dim_x]] &&
+      world.cur_map->cmap[dest[dim_y]][dest[dim_x]] != &world.pc) {
+    n = (npc *) world.cur_map->cmap[dest[dim_y]][dest[dim_x]];
+    if (world.cur_map->npcs.defeated[n->slot]) {
       // Some kind of greeting here would be nice
       return 1;
-    } else if (dynamic_cast<npc *>
-               (world.cur_map->cmap[dest[dim_y]][dest[dim_x]])) {
-      io_battle(&world.pc, world.cur_map->cmap[dest[dim_y]][dest[dim_x]]);
+    } else {
+      io_battle(&world.pc, n);
       // Not actually moving, so set dest back to PC position
       dest[dim_x] = world.pc.pos[dim_x];
       dest[dim_y] = world.pc.pos[dim_y];
@@ -975,25 +1107,21 @@ uint32_t move_pc_dir(uint32_t input, pair_t dest)
 
 void io_teleport_world(pair_t dest)
 {
-  /* mvscanw documentation is unclear about return values.  I believe *
-   * that the return value works the same way as scanf, but instead   *
-   * of counting on that, we'll initialize x and y to out of bounds   *
-   * values and accept their updates only if in range.                */
-  int x = INT_MAX, y = INT_MAX;
-  
-  world.cur_map->cmap[world.pc.pos[dim_y]][world.pc.pos[dim_x]] = NULL;
+  int x, y;
+
+  map_set_char(world.cur_map, world.pc.pos[dim_y], world.pc.pos[dim_x], NULL);
 
   echo();
   curs_set(1);
   do {
     mvprintw(0, 0, "Enter x [-200, 200]:           ");
     refresh();
-    mvscanw(0, 21, "%d", &x);
+    x = io_getint(0, 21);
   } while (x < -200 || x > 200);
   do {
     mvprintw(0, 0, "Enter y [-200, 200]:          ");
     refresh();
-    mvscanw(0, 21, "%d", &y);
+    y = io_getint(0, 21);
   } while (y < -200 || y > 200);
 
   refresh();
@@ -1016,7 +1144,7 @@ void io_handle_input(pair_t dest)
   int key;
 
   do {
-    switch (key = getch()) {
+    switch (key = io_getch()) {
     case '7':
     case 'y':
     case KEY_HOME:
@@ -1088,6 +1216,15 @@ void io_handle_input(pair_t dest)
       io_list_trainers();
       turn_not_consumed = 1;
       break;
+    case 'M':
+      io_message_history();
+      turn_not_consumed = 1;
+      break;
+    case 'S':
+      io_show_stats = !io_show_stats;
+      io_display();
+      turn_not_consumed = 1;
+      break;
     case 'f':
       /* Fly to any map in the world.                                */
       io_teleport_world(dest);
@@ -1095,7 +1232,7 @@ void io_handle_input(pair_t dest)
       break;
     case 'B':
       // bag - print items in bag with quantity (lines 4-6)
-      clear();
+      io_clear();
 
       mvprintw(0, 0, "Select an option by typing a key:");
 
@@ -1108,9 +1245,9 @@ void io_handle_input(pair_t dest)
       bool go_back;
       go_back = 0;
       do {
-        switch (key = getch()) {
+        switch (key = io_getch()) {
         case '1': //potion
-          clear();
+          io_clear();
           mvprintw(0, 0, "Select an option by typing a key:");
           
           for (int i = 0; i < (int) world.pc.pokemon_party.size(); i++) {
@@ -1118,7 +1255,7 @@ void io_handle_input(pair_t dest)
           }
 
           do {
-            switch (key = getch()) {
+            switch (key = io_getch()) {
             case '1':
               if (world.pc.pokemon_party[0].get_hp() != 0                                      && 
                   world.pc.pokemon_party[0].get_hp() != world.pc.pokemon_party[0].get_max_hp() &&
@@ -1128,7 +1265,7 @@ void io_handle_input(pair_t dest)
                 world.pc.bag_items[item_potion]--;
 
                 mvprintw(10, 0, "You used a potion.");
-                getch();
+                io_getch();
               }
               break;
             case '2':
@@ -1141,7 +1278,7 @@ void io_handle_input(pair_t dest)
                 world.pc.bag_items[item_potion]--;
 
                 mvprintw(10, 0, "You used a potion.");
-                getch();
+                io_getch();
               }
               break;
             case '3':
@@ -1154,7 +1291,7 @@ void io_handle_input(pair_t dest)
                 world.pc.bag_items[item_potion]--;
 
                 mvprintw(10, 0, "You used a potion.");
-                getch();
+                io_getch();
               }
               break;
             case '4':
@@ -1167,7 +1304,7 @@ void io_handle_input(pair_t dest)
                 world.pc.bag_items[item_potion]--;
 
                 mvprintw(10, 0, "You used a potion.");
-                getch();
+                io_getch();
               }
               break;
             case '5':
@@ -1180,7 +1317,7 @@ void io_handle_input(pair_t dest)
                 world.pc.bag_items[item_potion]--;
 
                 mvprintw(10, 0, "You used a potion.");
-                getch();
+                io_getch();
               }
               break;
             case '6':
@@ -1193,7 +1330,7 @@ void io_handle_input(pair_t dest)
                 world.pc.bag_items[item_potion]--;
 
                 mvprintw(10, 0, "You used a potion.");
-                getch();
+                io_getch();
               }
               break;
             case 27: //esc
@@ -1208,7 +1345,7 @@ void io_handle_input(pair_t dest)
 
           break;
         case '2': //revive
-          clear();
+          io_clear();
           mvprintw(0, 0, "Select an option by typing a key:");
           
           for (int i = 0; i < (int) world.pc.pokemon_party.size(); i++) {
@@ -1218,7 +1355,7 @@ void io_handle_input(pair_t dest)
           mvprintw(9, 0, "Press 'esc' to go back.");
 
           do {
-            switch (key = getch()) {
+            switch (key = io_getch()) {
             case '1':
               if (world.pc.pokemon_party[0].get_hp() == 0 && 
                   world.pc.bag_items[item_revive] != 0) {
@@ -1227,7 +1364,7 @@ void io_handle_input(pair_t dest)
                 world.pc.bag_items[item_revive]--;
 
                 mvprintw(10, 0, "You used a revive.");
-                getch();
+                io_getch();
               }
               break;
             case '2':
@@ -1239,7 +1376,7 @@ void io_handle_input(pair_t dest)
                 world.pc.bag_items[item_revive]--;
 
                 mvprintw(10, 0, "You used a revive.");
-                getch();
+                io_getch();
               }
               break;
             case '3':
@@ -1251,7 +1388,7 @@ void io_handle_input(pair_t dest)
                 world.pc.bag_items[item_revive]--;
 
                 mvprintw(10, 0, "You used a revive.");
-                getch();
+                io_getch();
               }
               break;
             case '4':
@@ -1263,7 +1400,7 @@ void io_handle_input(pair_t dest)
                 world.pc.bag_items[item_revive]--;
 
                 mvprintw(10, 0, "You used a revive.");
-                getch();
+                io_getch();
               }
               break;
             case '5':
@@ -1275,7 +1412,7 @@ void io_handle_input(pair_t dest)
                 world.pc.bag_items[item_revive]--;
 
                 mvprintw(10, 0, "You used a revive.");
-                getch();
+                io_getch();
               }
               break;
             case '6':
@@ -1287,7 +1424,7 @@ void io_handle_input(pair_t dest)
                 world.pc.bag_items[item_revive]--;
 
                 mvprintw(10, 0, "You used a revive.");
-                getch();
+                io_getch();
               }
               break;
             case 27: //esc
@@ -1351,181 +1488,24 @@ void io_handle_input(pair_t dest)
   } while (turn_not_consumed);
 }
 
-// returns 1 if battle ends, returns 0 otherwise
-int io_do_pokemon_battle_move(int pc_move_choice, pokemon *n) {
-  int move_cmp = cmp_pokemon_move_priority(pc_move_choice, &(world.pc.pokemon_party[0]), n);
-  
-  move(3, 0);
-  clrtobot();
-
-  if (move_cmp > 0) { // pc moves first
-    // pc move
-    mvprintw(3, 0, "%s used %s!", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_move(pc_move_choice));
-    getch();
-    if (do_battle_move(&(world.pc.pokemon_party[0]), n, world.pc.pokemon_party[0].get_move_index(pc_move_choice))) {
-      mvprintw(4, 0, "Missed!");
-    } else {
-      mvprintw(4, 0, "Hit!");
-    }
-    getch();
-    mvprintw(1, 0, "Wild %s, hp: %d", n->get_species(), n->get_hp());
-    clrtoeol();
-
-    // check npc for valid pokemon remaining
-    if (n->get_hp() == 0) {
-      return 1;
-    }
-
-    // npc move
-    int rand_move = rand_range(0, n->get_num_moves() - 1);
-    move(3, 0);
-    clrtobot();
-    mvprintw(3, 0, "%s used %s!", n->get_species(), n->get_move(rand_move));
-    getch();
-    if (do_battle_move(n, &(world.pc.pokemon_party[0]), n->get_move_index(rand_move))) {
-      mvprintw(4, 0, "Missed!");
-    } else {
-      mvprintw(4, 0, "Hit!");
-    }
-    getch();
-    mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
-    clrtoeol();
-
-    // check pc for valid pokemon remaining
-    if (check_pokemon_party_for_valid_pokemon(&world.pc)) {
-      return 1;
-    }
-
-  } else if (move_cmp < 0) { // npc moves first
-    // npc move
-    int rand_move = rand_range(0, n->get_num_moves() - 1);
-    mvprintw(3, 0, "%s used %s!", n->get_species(), n->get_move(rand_move));
-    getch();
-    if (do_battle_move(n, &(world.pc.pokemon_party[0]), n->get_move_index(rand_move))) {
-      mvprintw(4, 0, "Missed!");
-    } else {
-      mvprintw(4, 0, "Hit!");
-    }
-    getch();
-    mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
-    clrtoeol();
-
-    // check pc for valid pokemon remaining
-    if (check_pokemon_party_for_valid_pokemon(&world.pc)) {
-      return 1;
-    }
-
-    // pc move
-    move(3, 0);
-    clrtobot();
-    mvprintw(3, 0, "%s used %s!", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_move(pc_move_choice));
-    getch();
-    if (do_battle_move(&(world.pc.pokemon_party[0]), n, world.pc.pokemon_party[0].get_move_index(pc_move_choice))) {
-      mvprintw(4, 0, "Missed!");
-    } else {
-      mvprintw(4, 0, "Hit!");
-    }
-    getch();
-    mvprintw(1, 0, "Wild %s, hp: %d", n->get_species(), n->get_hp());
-    clrtoeol();
-
-    // check npc for valid pokemon remaining
-    if (n->get_hp() == 0) {
-      return 1;
-    }
-  } else { // randomly decide who moves first
-    if (rand_range(0,1) == 1) { // pc moves first
-      // pc move
-      mvprintw(3, 0, "%s used %s!", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_move(pc_move_choice));
-      getch();
-      if (do_battle_move(&(world.pc.pokemon_party[0]), n, world.pc.pokemon_party[0].get_move_index(pc_move_choice))) {
-        mvprintw(4, 0, "Missed!");
-      } else {
-        mvprintw(4, 0, "Hit!");
-      }
-      getch();
-      mvprintw(1, 0, "Wild %s, hp: %d", n->get_species(), n->get_hp());
-      clrtoeol();
-
-      // check npc for valid pokemon remaining
-      if (n->get_hp() == 0) {
-        return 1;
-      }
-
-      // npc move
-      int rand_move = rand_range(0, n->get_num_moves() - 1);
-      move(3, 0);
-      clrtobot();
-      mvprintw(3, 0, "%s used %s!", n->get_species(), n->get_move(rand_move));
-      getch();
-      if (do_battle_move(n, &(world.pc.pokemon_party[0]), n->get_move_index(rand_move))) {
-        mvprintw(4, 0, "Missed!");
-      } else {
-        mvprintw(4, 0, "Hit!");
-      }
-      getch();
-      mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
-      clrtoeol();
-
-      // check pc for valid pokemon remaining
-      if (check_pokemon_party_for_valid_pokemon(&world.pc)) {
-        return 1;
-      }
-    } else { // npc goes first
-      // npc move
-      int rand_move = rand_range(0, n->get_num_moves() - 1);
-      mvprintw(3, 0, "%s used %s!", n->get_species(), n->get_move(rand_move));
-      getch();
-      if (do_battle_move(n, &(world.pc.pokemon_party[0]), n->get_move_index(rand_move))) {
-        mvprintw(4, 0, "Missed!");
-      } else {
-        mvprintw(4, 0, "Hit!");
-      }
-      getch();
-      mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
-      clrtoeol();
-
-      // check pc for valid pokemon remaining
-      if (check_pokemon_party_for_valid_pokemon(&world.pc)) {
-        return 1;
-      }
-
-      // pc move
-      move(3, 0);
-      clrtobot();
-      mvprintw(3, 0, "%s used %s!", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_move(pc_move_choice));
-      getch();
-      if (do_battle_move(&(world.pc.pokemon_party[0]), n, world.pc.pokemon_party[0].get_move_index(pc_move_choice))) {
-        mvprintw(4, 0, "Missed!");
-      } else {
-        mvprintw(4, 0, "Hit!");
-      }
-      getch();
-      mvprintw(1, 0, "Wild %s, hp: %d", n->get_species(), n->get_hp());
-      clrtoeol();
-
-      // check npc for valid pokemon remaining
-      if (n->get_hp() == 0) {
-        return 1;
-      }
-    }
-
-  }
-
-  refresh();
-
-  return 0;
-}
-
 void io_pokemon_battle(pokemon *n)
 {
   int key;
   bool is_battle_over, turn_not_consumed, go_back;
-  int num_escape_attempts = 0;
+  battle_t b;
+  battle_action_t action;
 
+  battle_init(&b, world.pc.pokemon_party.data(), world.pc.pokemon_party.size(),
+              n, 1, world.pc.bag_items);
+  action.type = battle_action_fight;
+  action.index = 0;
+
+  io_in_battle = 1;
   is_battle_over = false;
   do {
-    clear();
+    trace_scope trace("wild_battle_turn", "battle");
+
+    io_clear();
     mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
     mvprintw(1, 0, "Wild Pokemon: %s, hp: %d", n->get_species(), n->get_hp());
     
@@ -1535,7 +1515,9 @@ void io_pokemon_battle(pokemon *n)
     mvprintw(6, 0, "r: Run");
     mvprintw(7, 0, "p: Pokemon");
 
-    switch (key = getch()) {
+    // any other key - do nothing, turn not consumed
+    go_back = 1;
+    switch (key = io_getch()) {
     case 'f':
       // TODO: fight - print pokemon moves as options (lines 1-4)
       move(4, 0);
@@ -1547,32 +1529,17 @@ void io_pokemon_battle(pokemon *n)
 
       mvprintw(10, 0, "Press 'esc' to go back");
       
-      // simulate move sequence with npc move
       go_back = 0;
       turn_not_consumed = 1;
       do {
-        switch (key = getch()) {
+        switch (key = io_getch()) {
           case '1':
-            if (world.pc.pokemon_party[0].get_num_moves() >= 1) {
-              is_battle_over = io_do_pokemon_battle_move(0, n);
-              turn_not_consumed = 0;
-            }
-            break;
           case '2':
-            if (world.pc.pokemon_party[0].get_num_moves() >= 2) {
-              is_battle_over = io_do_pokemon_battle_move(1, n);
-              turn_not_consumed = 0;
-            }
-            break;
           case '3':
-            if (world.pc.pokemon_party[0].get_num_moves() >= 3) {
-              is_battle_over = io_do_pokemon_battle_move(2, n);
-              turn_not_consumed = 0;
-            }
-            break;
           case '4':
-            if (world.pc.pokemon_party[0].get_num_moves() >= 4) {
-              is_battle_over = io_do_pokemon_battle_move(3, n);
+            if (world.pc.pokemon_party[0].get_num_moves() >= key - '0') {
+              action.type = battle_action_fight;
+              action.index = key - '1';
               turn_not_consumed = 0;
             }
             break;
@@ -1599,36 +1566,20 @@ void io_pokemon_battle(pokemon *n)
       turn_not_consumed = 1;
       go_back = 0;
       do {
-        switch (key = getch()) {
+        switch (key = io_getch()) {
         case '1': //potion
           if (world.pc.pokemon_party[0].get_hp() != 0                                      && 
               world.pc.pokemon_party[0].get_hp() != world.pc.pokemon_party[0].get_max_hp() &&
               world.pc.bag_items[item_potion] != 0) {
-                //add hp and decrement item
-                world.pc.pokemon_party[0].set_hp(std::min(world.pc.pokemon_party[0].get_max_hp(), world.pc.pokemon_party[0].get_hp() + 20));
-                world.pc.bag_items[item_potion]--;
-
-                mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
-                clrtoeol();
-                mvprintw(10, 0, "You used a potion.");
-                getch();
-
-                turn_not_consumed = 0;
+            action.type = battle_action_potion;
+            turn_not_consumed = 0;
           }
           break;
         case '2': //revive
           if (world.pc.pokemon_party[0].get_hp() == 0 && 
               world.pc.bag_items[item_revive] != 0) {
-                //add hp and decrement item
-                world.pc.pokemon_party[0].set_hp(world.pc.pokemon_party[0].get_max_hp() / 2);
-                world.pc.bag_items[item_revive]--;
-
-                mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
-                clrtoeol();
-                mvprintw(10, 0, "You used a revive.");
-                getch();
-
-                turn_not_consumed = 0;
+            action.type = battle_action_revive;
+            turn_not_consumed = 0;
           }
           break;
         case '3': //pokeball
@@ -1637,12 +1588,13 @@ void io_pokemon_battle(pokemon *n)
               world.pc.bag_items[item_pokeball] > 0) {
             world.pc.bag_items[item_pokeball]--;
             world.pc.pokemon_party.push_back(*n);
-            clear();
+            io_clear();
             mvprintw(0, 0, "You captured %s! %s has been added to your party.", n->get_species(), n->get_species());
-            getch();
+            io_getch();
           } else {
-            clear();
+            io_clear();
           }
+          io_in_battle = 0;
           return;
 
           break;
@@ -1654,45 +1606,11 @@ void io_pokemon_battle(pokemon *n)
           break;
         }
       } while (turn_not_consumed && !go_back);
-
-      if (!go_back) {
-        // npc move
-        int rand_move = rand_range(0, n->get_num_moves() - 1);
-        move(3, 0);
-        clrtobot();
-        mvprintw(3, 0, "Wild %s used %s!", n->get_species(), n->get_move(rand_move));
-        getch();
-        if (do_battle_move(n, &(world.pc.pokemon_party[0]), n->get_move_index(rand_move))) {
-          mvprintw(4, 0, "Missed!");
-        } else {
-          mvprintw(4, 0, "Hit!");
-        }
-        getch();
-        mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
-        clrtoeol();
-
-        // check pc for valid pokemon remaining
-        is_battle_over = check_pokemon_party_for_valid_pokemon(&world.pc);
-      }
-
       break;
     case 'r':
       // run - escape battle
-      int odds_escape;
-
-      num_escape_attempts++;
-      odds_escape = (world.pc.pokemon_party[0].get_speed() * 32) / ((n->get_speed() / 4) % 256) + 30 * num_escape_attempts;
-
-      if (rand() % 256 < odds_escape) {
-        clear();
-        mvprintw(0, 0, "You fled.");
-        getch();
-        return;
-      } else {
-        mvprintw(9, 0, "Could not escape!");
-        getch();
-      }
-      
+      action.type = battle_action_run;
+      go_back = 0;
       break;
     case 'p':
       // pokemon - print pokemon with hp (lines 4-9)
@@ -1708,39 +1626,16 @@ void io_pokemon_battle(pokemon *n)
       go_back = 0;
       turn_not_consumed = 1;
       do {
-        switch (key = getch()) {
+        switch (key = io_getch()) {
         case '2':
-          if (world.pc.pokemon_party.size() >= 2 &&
-              world.pc.pokemon_party[1].get_hp() > 0) {
-            switch_pokemon(&world.pc, 1);
-            turn_not_consumed = 0;
-          }
-          break;
         case '3':
-          if (world.pc.pokemon_party.size() >= 3 &&
-              world.pc.pokemon_party[2].get_hp() > 0) {
-            switch_pokemon(&world.pc, 2);
-            turn_not_consumed = 0;
-          }
-          break;
         case '4':
-          if (world.pc.pokemon_party.size() >= 4 &&
-              world.pc.pokemon_party[3].get_hp() > 0) {
-            switch_pokemon(&world.pc, 3);
-            turn_not_consumed = 0;
-          }
-          break;
         case '5':
-          if (world.pc.pokemon_party.size() >= 5 &&
-              world.pc.pokemon_party[4].get_hp() > 0) {
-            switch_pokemon(&world.pc, 4);
-            turn_not_consumed = 0;
-          }
-          break;
         case '6':
-          if (world.pc.pokemon_party.size() >= 6 &&
-              world.pc.pokemon_party[5].get_hp() > 0) {
-            switch_pokemon(&world.pc, 5);
+          if ((int) world.pc.pokemon_party.size() >= key - '0' &&
+              world.pc.pokemon_party[key - '1'].get_hp() > 0) {
+            action.type = battle_action_switch;
+            action.index = key - '1';
             turn_not_consumed = 0;
           }
           break;
@@ -1752,43 +1647,28 @@ void io_pokemon_battle(pokemon *n)
           break;
         }
       } while (turn_not_consumed && !go_back);
+      break;
+    }
 
-      if (!go_back) {
-        // npc move
-        int rand_move = rand_range(0, n->get_num_moves() - 1);
-        move(3, 0);
-        clrtobot();
-        mvprintw(3, 0, "%s used %s!", n->get_species(), n->get_move(rand_move));
-        getch();
-        if (do_battle_move(n, &(world.pc.pokemon_party[0]), n->get_move_index(rand_move))) {
-          mvprintw(4, 0, "Missed!");
-        } else {
-          mvprintw(4, 0, "Hit!");
-        }
-        getch();
-        mvprintw(0, 0, "Your Current Pokemon: %s, hp: %d", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_hp());
-        clrtoeol();
-
-        // check pc for valid pokemon remaining
-        is_battle_over = check_pokemon_party_for_valid_pokemon(&world.pc);
+    if (!go_back) {
+      is_battle_over = io_battle_round(&b, action, 1);
+      if (b.fled) {
+        io_in_battle = 0;
+        return;
       }
-
-      break;
-    default:
-      // any other key - do nothing, turn not consumed
-      break;
     }
 
     refresh();
   } while (!is_battle_over);
 
-  clear();
+  io_clear();
   if (world.pc.pokemon_party[0].get_hp() == 0) {
     mvprintw(0, 0, "You were defeated! Go to a Pokecenter to restore your pokemon to full health.");
   } else {
     mvprintw(0, 0, "Wild %s fainted.", n->get_species());
   }
-  getch();
+  io_getch();
+  io_in_battle = 0;
 }
 
 void io_encounter_pokemon()
@@ -1841,12 +1721,15 @@ void io_initial_pc_pokemon_selection() {
   
   do {
     p2 = new pokemon(1);
-  } while (!strcmp(p1->get_species(), p2->get_species()));
+  } while (p1->get_pokemon_species_index() ==
+           p2->get_pokemon_species_index());
 
   do {
     p3 = new pokemon(1);
-  } while (!strcmp(p1->get_species(), p3->get_species()) &&
-           !strcmp(p1->get_species(), p3->get_species()));
+  } while (p1->get_pokemon_species_index() ==
+           p3->get_pokemon_species_index() ||
+           p2->get_pokemon_species_index() ==
+           p3->get_pokemon_species_index());
   
   mvprintw(0, 0, "Welcome to Pokemon!");
   mvprintw(2, 0, "Select a pokemon by typing 1,2, or 3 from...");
@@ -1856,7 +1739,7 @@ void io_initial_pc_pokemon_selection() {
 
   int key;
   do {
-    key = getch();
+    key = io_getch();
     switch (key){
     case '1':
       world.pc.pokemon_party.push_back(*p1);
@@ -1875,5 +1758,5 @@ void io_initial_pc_pokemon_selection() {
            key != '3');
   
   mvprintw(7, 0, "You selected %s. %s has been added to your party.", world.pc.pokemon_party[0].get_species(), world.pc.pokemon_party[0].get_species());
-  getch();
+  io_getch();
 }
@@ -1,12 +1,19 @@
 #ifndef IO_H
 # define IO_H
 
+# include <stdint.h>
+
 typedef struct character character_t;
+class pokemon;
 typedef int16_t pair_t[2];
 
+/* Cap on map redraws per second; see io_display() */
+# define IO_DEFAULT_FPS 60
+
 void io_init_terminal(void);
 void io_reset_terminal(void);
 void io_display(void);
+void io_set_frame_rate(uint32_t fps);
 void io_handle_input(pair_t dest);
 void io_queue_message(const char *format, ...);
 void io_battle(character_t *aggressor, character_t *defender);
@@ -13,6 +13,13 @@
 #include "poke327.h"
 #include "io.h"
 #include "db_parse.h"
+#include "replay.h"
+#include "stats.h"
+#include "trace.h"
+#include "background.h"
+#include "battle_ai.h"
+#include "db_shm.h"
+#include "db_reload.h"
 
 typedef struct queue_node {
   int x, y;
@@ -41,12 +48,13 @@ static int32_t edge_penalty(int8_t x, int8_t y)
   return (x == 1 || y == 1 || x == MAP_X - 2 || y == MAP_Y - 2) ? 2 : 1;
 }
 
-static void dijkstra_path(map_t *m, pair_t from, pair_t to)
+void dijkstra_path(map_t *m, pair_t from, pair_t to)
 {
   static path_t path[MAP_Y][MAP_X], *p;
   static uint32_t initialized = 0;
   heap_t h;
   int32_t x, y;
+  trace_scope trace("dijkstra_path", "map");
 
   if (!initialized) {
     for (y = 0; y < MAP_Y; y++) {
@@ -242,9 +250,10 @@ static int smooth_height(map_t *m)
 {
   int32_t i, x, y;
   int32_t s, t, p, q;
-  queue_node_t *head, *tail, *tmp;
+  queue_node_t *head = NULL, *tail = NULL, *tmp;
   /*  FILE *out;*/
   uint8_t height[MAP_Y][MAP_X];
+  trace_scope trace("smooth_height", "map");
 
   memset(&height, 0, sizeof (height));
 
@@ -456,11 +465,12 @@ static int place_center(map_t *m)
 static int map_terrain(map_t *m, int8_t n, int8_t s, int8_t e, int8_t w)
 {
   int32_t i, x, y;
-  queue_node_t *head, *tail, *tmp;
+  queue_node_t *head = NULL, *tail = NULL, *tmp;
   //  FILE *out;
   int num_grass, num_clearing, num_mountain, num_forest, num_total;
   terrain_type_t type;
   int added_current = 0;
+  trace_scope trace("map_terrain", "map");
   
   num_grass = rand() % 4 + 2;
   num_clearing = rand() % 4 + 2;
@@ -671,129 +681,151 @@ void rand_pos(pair_t pos)
   pos[dim_y] = (rand() % (MAP_Y - 2)) + 1;
 }
 
-void new_hiker()
+/* Puts a new NPC at pos in the current map's next trainer slot, *
+ * facing nowhere.  Giving it its turns is up to the caller.     */
+static npc *new_npc(pair_t pos, character_type_t ctype,
+                    movement_type_t mtype, char symbol)
+{
+  map_t *m = world.cur_map;
+  npc *c;
+  int32_t i;
+
+  i = m->num_trainers++;
+  c = new npc;
+  c->slot = i;
+  c->symbol = symbol;
+  m->trainer[i] = c;
+  m->npcs.pos[i][dim_y] = pos[dim_y];
+  m->npcs.pos[i][dim_x] = pos[dim_x];
+  m->npcs.dir[i][dim_y] = 0;
+  m->npcs.dir[i][dim_x] = 0;
+  m->npcs.next_turn[i] = 0;
+  m->npcs.ctype[i] = ctype;
+  m->npcs.mtype[i] = mtype;
+  m->npcs.defeated[i] = 0;
+  map_set_char(m, pos[dim_y], pos[dim_x], c);
+
+  return c;
+}
+
+int new_hiker()
 {
   pair_t pos;
   npc *c;
+  int tries = 0;
 
   do {
+    if (++tries > MAX_TRAINER_TRIES) {
+      return 0;
+    }
     rand_pos(pos);
   } while (world.hiker_dist[pos[dim_y]][pos[dim_x]] == INT_MAX ||
-           world.cur_map->cmap[pos[dim_y]][pos[dim_x]]         ||
+           map_occupied(world.cur_map, pos[dim_y], pos[dim_x]) ||
            pos[dim_x] < 3 || pos[dim_x] > MAP_X - 4            ||
            pos[dim_y] < 3 || pos[dim_y] > MAP_Y - 4);
 
-  world.cur_map->cmap[pos[dim_y]][pos[dim_x]] = c = new npc;
-  c->pos[dim_y] = pos[dim_y];
-  c->pos[dim_x] = pos[dim_x];
-  c->ctype = char_hiker;
-  c->mtype = move_hiker;
-  c->dir[dim_x] = 0;
-  c->dir[dim_y] = 0;
-  c->defeated = 0;
-  c->symbol = 'h';
-  c->next_turn = 0;
-  heap_insert(&world.cur_map->turn, c);
-  world.cur_map->cmap[pos[dim_y]][pos[dim_x]] = c;
+  c = new_npc(pos, char_hiker, move_hiker, 'h');
+  turn_queue_insert(&world.cur_map->turn, c, 0);
 
   //  printf("Hiker at %d,%d\n", pos[dim_x], pos[dim_y]);
+
+  return 1;
 }
 
-void new_rival()
+int new_rival()
 {
   pair_t pos;
   npc *c;
+  int tries = 0;
 
   do {
+    if (++tries > MAX_TRAINER_TRIES) {
+      return 0;
+    }
     rand_pos(pos);
   } while (world.rival_dist[pos[dim_y]][pos[dim_x]] == INT_MAX ||
            world.rival_dist[pos[dim_y]][pos[dim_x]] < 0        ||
-           world.cur_map->cmap[pos[dim_y]][pos[dim_x]]         ||
+           map_occupied(world.cur_map, pos[dim_y], pos[dim_x]) ||
            pos[dim_x] < 3 || pos[dim_x] > MAP_X - 4            ||
            pos[dim_y] < 3 || pos[dim_y] > MAP_Y - 4);
 
-  world.cur_map->cmap[pos[dim_y]][pos[dim_x]] = c = new npc;
-  c->pos[dim_y] = pos[dim_y];
-  c->pos[dim_x] = pos[dim_x];
-  c->ctype = char_rival;
-  c->mtype = move_rival;
-  c->dir[dim_x] = 0;
-  c->dir[dim_y] = 0;
-  c->defeated = 0;
-  c->symbol = 'r';
-  c->next_turn = 0;
-  heap_insert(&world.cur_map->turn, c);
-  world.cur_map->cmap[pos[dim_y]][pos[dim_x]] = c;
+  c = new_npc(pos, char_rival, move_rival, 'r');
+  turn_queue_insert(&world.cur_map->turn, c, 0);
+
+  return 1;
 }
 
-void new_char_other()
+int new_char_other()
 {
   pair_t pos;
   npc *c;
+  int tries = 0;
 
   do {
+    if (++tries > MAX_TRAINER_TRIES) {
+      return 0;
+    }
     rand_pos(pos);
   } while (world.rival_dist[pos[dim_y]][pos[dim_x]] == INT_MAX ||
            world.rival_dist[pos[dim_y]][pos[dim_x]] < 0        ||
-           world.cur_map->cmap[pos[dim_y]][pos[dim_x]]         ||
+           map_occupied(world.cur_map, pos[dim_y], pos[dim_x]) ||
            pos[dim_x] < 3 || pos[dim_x] > MAP_X - 4            ||
            pos[dim_y] < 3 || pos[dim_y] > MAP_Y - 4);
 
-  world.cur_map->cmap[pos[dim_y]][pos[dim_x]] = c = new npc;
-  c->pos[dim_y] = pos[dim_y];
-  c->pos[dim_x] = pos[dim_x];
-  c->ctype = char_other;
   switch (rand() % 4) {
   case 0:
-    c->mtype = move_pace;
-    c->symbol = 'p';
+    c = new_npc(pos, char_other, move_pace, 'p');
     break;
   case 1:
-    c->mtype = move_wander;
-    c->symbol = 'w';
+    c = new_npc(pos, char_other, move_wander, 'w');
     break;
   case 2:
-    c->mtype = move_sentry;
-    c->symbol = 's';
+    c = new_npc(pos, char_other, move_sentry, 's');
     break;
-  case 3:
-    c->mtype = move_walk;
-    c->symbol = 'n';
+  default:
+    c = new_npc(pos, char_other, move_walk, 'n');
     break;
   }
-  rand_dir(c->dir);
-  c->defeated = 0;
-  c->next_turn = 0;
-  heap_insert(&world.cur_map->turn, c);
-  world.cur_map->cmap[pos[dim_y]][pos[dim_x]] = c;
+  rand_dir(world.cur_map->npcs.dir[c->slot]);
+  /* Sentries never move, and never start a fight, so their turns do *
+   * nothing.  Nothing turns a sentry into anything else, either, so *
+   * they can sit out the turn order for good.                       */
+  if (world.cur_map->npcs.mtype[c->slot] == move_sentry) {
+    turn_queue_park(&world.cur_map->turn, c);
+  } else {
+    turn_queue_insert(&world.cur_map->turn, c, 0);
+  }
+
+  return 1;
 }
 
 void place_characters()
 {
-  world.cur_map->num_trainers = 2;
+  int placed;
 
   //Always place a hiker and a rival, then place a random number of others
+  world.cur_map->num_trainers = 0;
   new_hiker();
   new_rival();
   do {
     //higher probability of non- hikers and rivals
     switch(rand() % 10) {
     case 0:
-      new_hiker();
+      placed = new_hiker();
       break;
     case 1:
-     new_rival();
+      placed = new_rival();
       break;
     default:
-      new_char_other();
+      placed = new_char_other();
       break;
     }
     /* Game attempts to continue to place trainers until the probability *
      * roll fails, but if the map is full (or almost full), it's         *
      * impossible (or very difficult) to continue to add, so we abort if *
      * we've tried MAX_TRAINER_TRIES times.                              */
-  } while (++world.cur_map->num_trainers < MIN_TRAINERS ||
-           ((rand() % 100) < ADD_TRAINER_PROB));
+  } while (placed && (world.cur_map->num_trainers < MIN_TRAINERS ||
+                      ((rand() % 100) < ADD_TRAINER_PROB)));
 }
 
 void init_pc()
@@ -809,16 +841,14 @@ void init_pc()
   world.pc.pos[dim_y] = y;
   world.pc.symbol = '@';
 
-  world.cur_map->cmap[y][x] = &world.pc;
+  map_set_char(world.cur_map, y, x, &world.pc);
   world.pc.next_turn = 0;
 
-  heap_insert(&world.cur_map->turn, &world.pc);
+  turn_queue_insert(&world.cur_map->turn, &world.pc, 0);
 }
 
 void place_pc()
 {
-  character *c;
-
   if (world.pc.pos[dim_x] == 1) {
     world.pc.pos[dim_x] = MAP_X - 2;
   } else if (world.pc.pos[dim_x] == MAP_X - 2) {
@@ -829,10 +859,12 @@ void place_pc()
     world.pc.pos[dim_y] = 1;
   }
 
-  world.cur_map->cmap[world.pc.pos[dim_y]][world.pc.pos[dim_x]] = &world.pc;
+  map_set_char(world.cur_map, world.pc.pos[dim_y], world.pc.pos[dim_x],
+               &world.pc);
 
-  if ((c = (character *) heap_peek_min(&world.cur_map->turn))) {
-    world.pc.next_turn = c->next_turn;
+  /* Peeking leaves now at the tick the next character is due */
+  if (turn_queue_peek_min(&world.cur_map->turn)) {
+    world.pc.next_turn = world.cur_map->turn.now;
   } else {
     world.pc.next_turn = 0;
   }
@@ -845,20 +877,28 @@ int new_map(int teleport)
 {
   int d, p;
   int e, w, n, s;
-  int x, y;
-  
+
+  background_leave(world.cur_map);
+
   if (world.world[world.cur_idx[dim_y]][world.cur_idx[dim_x]]) {
     world.cur_map = world.world[world.cur_idx[dim_y]][world.cur_idx[dim_x]];
+    background_enter(world.cur_map);
     place_pc();
 
     return 0;
   }
 
+  stats_timer timer(stats_new_map);
+  trace_scope trace("new_map", "map");
+  stats_mark_t mark;
+
   world.cur_map                                             =
     world.world[world.cur_idx[dim_y]][world.cur_idx[dim_x]] =
     (map_t *) malloc(sizeof (*world.cur_map));
 
+  stats_begin(&mark);
   smooth_height(world.cur_map);
+  stats_end(&mark, stats_smooth_height);
   
   if (!world.cur_idx[dim_y]) {
     n = -1;
@@ -889,11 +929,15 @@ int new_map(int teleport)
     e = 3 + rand() % (MAP_Y - 6);
   }
   
+  stats_begin(&mark);
   map_terrain(world.cur_map, n, s, e, w);
+  stats_end(&mark, stats_map_terrain);
      
   place_boulders(world.cur_map);
   place_trees(world.cur_map);
+  stats_begin(&mark);
   build_paths(world.cur_map);
+  stats_end(&mark, stats_build_paths);
   d = (abs(world.cur_idx[dim_x] - (WORLD_SIZE / 2)) +
        abs(world.cur_idx[dim_y] - (WORLD_SIZE / 2)));
   p = d > 200 ? 5 : (50 - ((45 * d) / 200));
@@ -905,13 +949,10 @@ int new_map(int teleport)
     place_center(world.cur_map);
   }
 
-  for (y = 0; y < MAP_Y; y++) {
-    for (x = 0; x < MAP_X; x++) {
-      world.cur_map->cmap[y][x] = NULL;
-    }
-  }
+  memset(world.cur_map->cmap, 0, sizeof (world.cur_map->cmap));
+  memset(world.cur_map->occupied, 0, sizeof (world.cur_map->occupied));
 
-  heap_init(&world.cur_map->turn, cmp_char_turns, delete_character);
+  turn_queue_init(&world.cur_map->turn);
 
   if ((world.cur_idx[dim_x] == WORLD_SIZE / 2) &&
       (world.cur_idx[dim_y] == WORLD_SIZE / 2)) {
@@ -922,20 +963,25 @@ int new_map(int teleport)
 
   if (teleport) {
     do {
-      world.cur_map->cmap[world.pc.pos[dim_y]][world.pc.pos[dim_x]] = NULL;
+      map_set_char(world.cur_map, world.pc.pos[dim_y], world.pc.pos[dim_x],
+                   NULL);
       world.pc.pos[dim_x] = rand_range(1, MAP_X - 2);
       world.pc.pos[dim_y] = rand_range(1, MAP_Y - 2);
-    } while (world.cur_map->cmap[world.pc.pos[dim_y]][world.pc.pos[dim_x]] ||
+    } while (map_occupied(world.cur_map,
+                          world.pc.pos[dim_y], world.pc.pos[dim_x]) ||
              (move_cost[char_pc][world.cur_map->map[world.pc.pos[dim_y]]
                                                    [world.pc.pos[dim_x]]] ==
               INT_MAX)                                                      ||
              world.rival_dist[world.pc.pos[dim_y]][world.pc.pos[dim_x]] < 0);
-    world.cur_map->cmap[world.pc.pos[dim_y]][world.pc.pos[dim_x]] = &world.pc;
+    map_set_char(world.cur_map, world.pc.pos[dim_y], world.pc.pos[dim_x],
+                 &world.pc);
   }
 
   pathfind(world.cur_map);
   
+  stats_begin(&mark);
   place_characters();
+  stats_end(&mark, stats_place_characters);
 
   return 0;
 }
@@ -1006,7 +1052,7 @@ void delete_world()
 
   //Only correct because current game never leaves the initial map
   //Need to iterate over all maps in 1.05+
-  heap_delete(&world.cur_map->turn);
+  turn_queue_delete(&world.cur_map->turn);
 
   for (y = 0; y < WORLD_SIZE; y++) {
     for (x = 0; x < WORLD_SIZE; x++) {
@@ -1066,50 +1112,135 @@ void leave_map(pair_t d)
 
 void game_loop()
 {
+  character *batch[MAX_TRAINERS + 1];
   character *c;
+  map_t *m;
+  int n, i, t;
+  int32_t s;
+  int16_t *pos;
+  int *next_turn;
+  character_type_t ctype;
   pair_t d;
   bool is_pc;
+  stats_mark_t turn, npc_move;
+  uint64_t npc_time;
+  const char *move_name;
 
   io_initial_pc_pokemon_selection();
 
+  npc_time = 0;
+  stats_begin(&turn);
   while (!world.quit) {
-    c = (character *) heap_remove_min(&world.cur_map->turn);
-    is_pc = dynamic_cast<npc *>(c) == NULL;
+    /* Everyone due at the same time is taken off the queue as one  *
+     * batch and moves in the order they were queued.  Each move    *
+     * sees cmap as the moves before it left it, so two characters  *
+     * never claim one cell, and the order is the same every run.   */
+    m = world.cur_map;
+    batch[0] = turn_queue_remove_min(&m->turn);
+    t = m->turn.now;
+    for (n = 1; turn_queue_peek_min(&m->turn) && m->turn.now == t; n++) {
+      batch[n] = turn_queue_remove_min(&m->turn);
+    }
 
-    move_func[is_pc ? move_pc : ((npc *) c)->mtype](c, d);
+    for (i = 0; i < n && world.cur_map == m && !world.quit; i++) {
+      /* The PC's fields are its own; an NPC's are in m->npcs */
+      c = batch[i];
+      is_pc = c == &world.pc;
+
+      if (is_pc) {
+        s = -1;
+        pos = world.pc.pos;
+        next_turn = &world.pc.next_turn;
+        ctype = char_pc;
+        /* A turn runs from one PC move to the next */
+        if (world.turn_count) {
+          stats_end(&turn, stats_turn);
+          stats_record(stats_npc_moves, npc_time);
+          trace_end("turn", "game_loop");
+        }
+        /* Between turns, so nothing is halfway through the old one */
+        if (db_reload_poll()) {
+          io_queue_message("The pokedex has been reloaded.");
+        }
+        npc_time = 0;
+        stats_begin(&turn);
+        trace_begin("turn", "game_loop");
+        move_func[move_pc](m, s, d);
+      } else {
+        s = ((npc *) c)->slot;
+        pos = m->npcs.pos[s];
+        next_turn = m->npcs.next_turn + s;
+        ctype = m->npcs.ctype[s];
+        /* Losing a battle changes mtype, so end under the name we began */
+        move_name = move_type_name[m->npcs.mtype[s]];
+        stats_begin(&npc_move);
+        trace_begin(move_name, "move_func");
+        move_func[m->npcs.mtype[s]](m, s, d);
+        trace_end(move_name, "move_func");
+        npc_time += stats_elapsed(&npc_move);
+      }
 
-    world.cur_map->cmap[c->pos[dim_y]][c->pos[dim_x]] = NULL;
-    if (is_pc && (d[dim_x] == 0 || d[dim_x] == MAP_X - 1 ||
-                  d[dim_y] == 0 || d[dim_y] == MAP_Y - 1)) {
-      leave_map(d);
-      d[dim_x] = c->pos[dim_x];
-      d[dim_y] = c->pos[dim_y];
-    }
-    world.cur_map->cmap[d[dim_y]][d[dim_x]] = c;
+      map_set_char(world.cur_map, pos[dim_y], pos[dim_x], NULL);
+      if (is_pc && (d[dim_x] == 0 || d[dim_x] == MAP_X - 1 ||
+                    d[dim_y] == 0 || d[dim_y] == MAP_Y - 1)) {
+        /* A diagonal step onto an exit leaves the PC off the exit's row *
+         * (or column).  Line it up so place_pc() lands on the road.     */
+        if (d[dim_x] == 0 || d[dim_x] == MAP_X - 1) {
+          pos[dim_y] = d[dim_y];
+        } else {
+          pos[dim_x] = d[dim_x];
+        }
+        leave_map(d);
+        d[dim_x] = pos[dim_x];
+        d[dim_y] = pos[dim_y];
+      }
+      map_set_char(world.cur_map, d[dim_y], d[dim_x], c);
 
-    if (is_pc) {
-      pathfind(world.cur_map);
-    }
+      if (is_pc) {
+        pathfind(world.cur_map);
+        if (++world.turn_count == world.turn_limit) {
+          world.quit = 1;
+        }
+        background_tick();
+      }
+
+      *next_turn += move_cost[ctype][world.cur_map->map[d[dim_y]][d[dim_x]]];
 
-    c->next_turn += move_cost[is_pc ? char_pc : ((npc *) c)->ctype]
-                             [world.cur_map->map[d[dim_y]][d[dim_x]]];
+      if (is_pc &&
+          (pos[dim_y] != d[dim_y] || pos[dim_x] != d[dim_x]) &&
+          (world.cur_map->map[d[dim_y]][d[dim_x]] == ter_grass) &&
+          (rand() % 100 < ENCOUNTER_PROB)) {
+        io_encounter_pokemon();
+      }
 
-    if (is_pc && (c->pos[dim_y] != d[dim_y] || c->pos[dim_x] != d[dim_x]) &&
-        (world.cur_map->map[d[dim_y]][d[dim_x]] == ter_grass) &&
-        (rand() % 100 < ENCOUNTER_PROB)) {
-      io_encounter_pokemon();
+      pos[dim_y] = d[dim_y];
+      pos[dim_x] = d[dim_x];
+
+      turn_queue_insert(&world.cur_map->turn, c, *next_turn);
     }
 
-    c->pos[dim_y] = d[dim_y];
-    c->pos[dim_x] = d[dim_x];
+    /* If the PC left the map or the game ended partway through the *
+     * batch, the rest keep their places until it comes back.       */
+    for (; i < n; i++) {
+      turn_queue_insert(&m->turn, batch[i], t);
+    }
+  }
 
-    heap_insert(&world.cur_map->turn, c);
+  if (world.turn_count) {
+    trace_end("turn", "game_loop");
   }
 }
 
+/* The benchmark (bench.cpp) links everything above with its own main(). */
+#ifndef BENCH
 void usage(char *s)
 {
-  fprintf(stderr, "Usage: %s [-s|--seed <seed>]\n", s);
+  fprintf(stderr, "Usage: %s [-s|--seed <seed>] [-t|--turns <turns>]\n"
+          "          [-r|--record <file>] [-p|--replay <file>]\n"
+          "          [--stats-file <file>] [--trace <file>] "
+          "[-f|--fps <fps>]\n"
+          "          [-b|--background <turns>] [-a|--battle-ai <ms>]\n"
+          "          [--shm <name>] [--db-threads <n>] [--reload]\n", s);
 
   exit(1);
 }
@@ -1117,14 +1248,36 @@ void usage(char *s)
 int main(int argc, char *argv[])
 {
   struct timeval tv;
+#ifdef HEADLESS
+  struct timeval end;
+  double elapsed;
+#endif
   uint32_t seed;
+  uint32_t turn_limit;
+  uint32_t fps;
+  uint32_t background;
+  uint32_t battle_ai;
+  uint32_t db_threads;
   int long_arg;
+  int reload;
   int do_seed;
+  int do_turns;
+  char *record_path, *replay_path;
+  char *stats_path;
+  char *trace_path;
+  char *shm_name;
   //  char c;
   //  int x, y;
   int i;
 
   do_seed = 1;
+  do_turns = 0;
+  fps = IO_DEFAULT_FPS;
+  background = 0;
+  battle_ai = 0;
+  db_threads = 1;
+  reload = 0;
+  record_path = replay_path = stats_path = trace_path = shm_name = NULL;
   
   if (argc > 1) {
     for (i = 1, long_arg = 0; i < argc; i++, long_arg = 0) {
@@ -1135,6 +1288,20 @@ int main(int argc, char *argv[])
         }
         switch (argv[i][1]) {
         case 's':
+          if (long_arg && !strcmp(argv[i], "-stats-file")) {
+            if (argc < ++i + 1 /* No more arguments */) {
+              usage(argv[0]);
+            }
+            stats_path = argv[i];
+            break;
+          }
+          if (long_arg && !strcmp(argv[i], "-shm")) {
+            if (argc < ++i + 1 /* No more arguments */) {
+              usage(argv[0]);
+            }
+            shm_name = argv[i];
+            break;
+          }
           if ((!long_arg && argv[i][2]) ||
               (long_arg && strcmp(argv[i], "-seed")) ||
               argc < ++i + 1 /* No more arguments */ ||
@@ -1143,6 +1310,79 @@ int main(int argc, char *argv[])
           }
           do_seed = 0;
           break;
+        case 't':
+          if (long_arg && !strcmp(argv[i], "-trace")) {
+            if (argc < ++i + 1 /* No more arguments */) {
+              usage(argv[0]);
+            }
+            trace_path = argv[i];
+            break;
+          }
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-turns")) ||
+              argc < ++i + 1 /* No more arguments */ ||
+              !sscanf(argv[i], "%u", &world.turn_limit)) {
+            usage(argv[0]);
+          }
+          do_turns = 1;
+          break;
+        case 'r':
+          if (long_arg && !strcmp(argv[i], "-reload")) {
+            reload = 1;
+            break;
+          }
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-record")) ||
+              argc < ++i + 1 /* No more arguments */) {
+            usage(argv[0]);
+          }
+          record_path = argv[i];
+          break;
+        case 'p':
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-replay")) ||
+              argc < ++i + 1 /* No more arguments */) {
+            usage(argv[0]);
+          }
+          replay_path = argv[i];
+          break;
+        case 'f':
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-fps")) ||
+              argc < ++i + 1 /* No more arguments */ ||
+              !sscanf(argv[i], "%u", &fps)) {
+            usage(argv[0]);
+          }
+          break;
+        case 'b':
+          if (long_arg && !strcmp(argv[i], "-battle-ai")) {
+            if (argc < ++i + 1 /* No more arguments */ ||
+                !sscanf(argv[i], "%u", &battle_ai)) {
+              usage(argv[0]);
+            }
+            break;
+          }
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-background")) ||
+              argc < ++i + 1 /* No more arguments */ ||
+              !sscanf(argv[i], "%u", &background)) {
+            usage(argv[0]);
+          }
+          break;
+        case 'a':
+          if (long_arg || argv[i][2] ||
+              argc < ++i + 1 /* No more arguments */ ||
+              !sscanf(argv[i], "%u", &battle_ai)) {
+            usage(argv[0]);
+          }
+          break;
+        case 'd':
+          if (!long_arg || strcmp(argv[i], "-db-threads") ||
+              argc < ++i + 1 /* No more arguments */ ||
+              !sscanf(argv[i], "%u", &db_threads)) {
+            usage(argv[0]);
+          }
+          break;
         default:
           usage(argv[0]);
         }
@@ -1159,12 +1399,44 @@ int main(int argc, char *argv[])
     seed = (tv.tv_usec ^ (tv.tv_sec << 20)) & 0xffffffff;
   }
 
+  /* A replay has to start from the seed it was recorded with.  It also *
+   * ends where the recording did, unless told to stop sooner.          */
+  if (replay_path) {
+    if (replay_play_open(replay_path, &seed, &turn_limit)) {
+      exit(1);
+    }
+    if (!do_turns) {
+      world.turn_limit = turn_limit;
+    }
+  }
+  if (record_path && replay_record_open(record_path, seed, world.turn_limit)) {
+    exit(1);
+  }
+  if (stats_path && stats_open(stats_path)) {
+    exit(1);
+  }
+  if (trace_path && trace_open(trace_path)) {
+    exit(1);
+  }
+  if (background_start(background)) {
+    exit(1);
+  }
+  battle_ai_budget(battle_ai);
+
   printf("Using seed: %u\n", seed);
   srand(seed);
+  world.seed = seed;
 
-  db_parse(false);
+  db_parse_threads(db_threads);
+  if (!shm_name || db_shm_load(shm_name)) {
+    db_parse(false);
+  }
+  if (reload && db_reload_start()) {
+    exit(1);
+  }
 
   io_init_terminal();
+  io_set_frame_rate(fps);
   
   init_world();
 
@@ -1231,11 +1503,41 @@ int main(int argc, char *argv[])
 
   */
 
+#ifdef HEADLESS
+  gettimeofday(&tv, NULL);
+#endif
+
   game_loop();
-  
+
+#ifdef HEADLESS
+  gettimeofday(&end, NULL);
+  elapsed = ((end.tv_sec - tv.tv_sec) +
+             (end.tv_usec - tv.tv_usec) / 1000000.0);
+  printf("%u turns in %.3fs (%.0f turns/s), ended on map %d%cx%d%c.\n",
+         world.turn_count, elapsed,
+         elapsed > 0 ? world.turn_count / elapsed : 0.0,
+         abs(world.cur_idx[dim_x] - (WORLD_SIZE / 2)),
+         world.cur_idx[dim_x] - (WORLD_SIZE / 2) >= 0 ? 'E' : 'W',
+         abs(world.cur_idx[dim_y] - (WORLD_SIZE / 2)),
+         world.cur_idx[dim_y] - (WORLD_SIZE / 2) <= 0 ? 'N' : 'S');
+#endif
+
+  background_stop();
+  db_reload_stop();
+
   delete_world();
 
   io_reset_terminal();
+
+  replay_close();
+
+  trace_close();
+
+  if (stats_write()) {
+    return 1;
+  }
   
   return 0;
 }
+
+#endif
@@ -7,6 +7,7 @@
 # include <vector>
 
 # include "heap.h"
+# include "turn_queue.h"
 # include "pair.h"
 # include "pokemon.h"
 
@@ -28,8 +29,11 @@
 #define BOULDER_PROB       95
 #define WORLD_SIZE         401
 #define MIN_TRAINERS       7   
+#define MAX_TRAINER_TRIES  1000
 #define ADD_TRAINER_PROB   50
 #define ENCOUNTER_PROB     10
+/* Trainers are placed at least 3 cells from the edge of the map */
+#define MAX_TRAINERS       ((MAP_X - 6) * (MAP_Y - 6))
 
 #define mappair(pair) (m->map[pair[dim_y]][pair[dim_x]])
 #define mapxy(x, y) (m->map[y][x])
@@ -76,26 +80,27 @@ typedef enum __attribute__ ((__packed__)) bag_item_type {
   num_bag_items
 } bag_item_t;
 
+/* An NPC's position, movement and turn are kept with its map (see     *
+ * map_npcs_t), under its trainer slot, and the PC's in class pc.  The *
+ * turn loop tells the PC by its address, so it needs no RTTI.         */
 class character {
  public:
   virtual ~character() {};
 
-  pair_t pos;
   char symbol;
-  int next_turn;
+  character *turn_next; /* Next due at the same tick; see turn_queue.h */
   std::vector<pokemon> pokemon_party;
 };
 
 class npc : public character {
  public:
-  character_type_t ctype;
-  movement_type_t mtype;
-  int defeated;
-  pair_t dir;
+  int32_t slot;         /* In its map's trainer[] and npcs */
 };
 
 class pc : public character {
 public:
+  pair_t pos;
+  int next_turn;
   int bag_items[num_bag_items];
   
   pc() {
@@ -108,26 +113,65 @@ public:
 /* character is defined in poke327.h to allow an instance of character
  * in world without including character.h in poke327.h                 */
 
-int32_t cmp_char_turns(const void *key, const void *with);
 void delete_character(void *v);
 
 int pc_move(char);
 
 extern const char *char_type_name[num_character_types];
+extern const char *move_type_name[num_movement_types];
 
 extern int32_t move_cost[num_character_types][num_terrain_types];
 
+/* The fields the turn loop reads and writes of a map's NPCs, one    *
+ * array each, indexed by trainer slot: trainer[i] is at pos[i], and *
+ * so on.  Moving the NPCs walks a few dense arrays rather than an   *
+ * object apiece; the npc objects keep only what battles need.       */
+typedef struct map_npcs {
+  pair_t pos[MAX_TRAINERS];
+  pair_t dir[MAX_TRAINERS];
+  int next_turn[MAX_TRAINERS];
+  character_type_t ctype[MAX_TRAINERS];
+  movement_type_t mtype[MAX_TRAINERS];
+  uint8_t defeated[MAX_TRAINERS];
+} map_npcs_t;
+
 typedef struct map {
   terrain_type_t map[MAP_Y][MAP_X];
   uint8_t height[MAP_Y][MAP_X];
   character *cmap[MAP_Y][MAP_X];
-  heap_t turn;
+  /* One bit per cmap cell, set when it holds a character.  A row fits *
+   * in two words, so collision tests don't touch cmap at all.         */
+  uint64_t occupied[MAP_Y][(MAP_X + 63) / 64];
+  turn_queue_t turn;
+  /* Every NPC on the map, in the order they were placed */
+  npc *trainer[MAX_TRAINERS];
   int32_t num_trainers;
+  map_npcs_t npcs;
   int8_t n, s, e, w;
 } map_t;
 
+/* Puts c (or nobody, if c is NULL) at (x, y), keeping occupied in step *
+ * with cmap.  All changes to cmap go through here.                     */
+static inline void map_set_char(map_t *m, int y, int x, character *c)
+{
+  m->cmap[y][x] = c;
+  if (c) {
+    m->occupied[y][x >> 6] |= 1ULL << (x & 63);
+  } else {
+    m->occupied[y][x >> 6] &= ~(1ULL << (x & 63));
+  }
+}
+
+static inline int map_occupied(const map_t *m, int y, int x)
+{
+  return (m->occupied[y][x >> 6] >> (x & 63)) & 1;
+}
+
 void pathfind(map_t *m);
-extern void (*move_func[num_movement_types])(character *, pair_t);
+/* Moves trainer slot i of m, or the PC (move_pc, which ignores i), *
+ * by setting dest to where it goes.                                */
+extern void (*move_func[num_movement_types])(map_t *m, int32_t i,
+                                             pair_t dest);
 
 typedef struct world {
   map_t *world[WORLD_SIZE][WORLD_SIZE];
@@ -140,6 +184,10 @@ typedef struct world {
   class pc pc;
   int quit;
   int add_trainer_prob;
+  uint32_t seed;
+  /* PC turns taken so far, and the count at which to quit (0 for none). */
+  uint32_t turn_count;
+  uint32_t turn_limit;
 } world_t;
 
 /* Even unallocated, a WORLD_SIZE x WORLD_SIZE array of pointers is a very *
@@ -162,5 +210,8 @@ typedef struct path {
 } path_t;
 
 int new_map(int teleport);
+void dijkstra_path(map_t *m, pair_t from, pair_t to);
+void init_world();
+void delete_world();
 
 #endif
@@ -10,32 +10,38 @@ static bool operator<(const levelup_move &f, const levelup_move &s)
   return ((f.level < s.level) || ((f.level == s.level) && f.move < s.move));
 }
 
-pokemon::pokemon(int level) : level(level)
+static inline int pokemon_rand(unsigned int *seed)
+{
+  return seed ? rand_r(seed) : rand();
+}
+
+/* Builds species index's level-up move list and base stats, the first *
+ * time a pokemon of that species is made.                             */
+static pokemon_species_db *pokemon_load_species(int index)
 {
   pokemon_species_db *s;
-  unsigned i, j;
+  db_range r;
+  int i, m;
+  unsigned j;
   bool found;
 
-  // Subtract 1 because array is 1-indexed
-  pokemon_species_index = rand() % ((sizeof (species) /
-                                     sizeof (species[0])) - 1);
-  s = species + pokemon_species_index;
-  
-  if (!s->levelup_moves.size()) {
+  s = &species[index];
+
+  if (!s->loaded) {
     // We have never generated a pokemon of this species before, so we
     // need to find it's level-up moveset and save it for next time.
-    for (i = 1; i < (sizeof (pokemon_moves) /
-                     sizeof (pokemon_moves[0])); i++) {
-      if (s->id == pokemon_moves[i].pokemon_id &&
-          pokemon_moves[i].pokemon_move_method_id == 1) {
+    // Moves are kept by their row in moves[], which needn't be their id.
+    r = db_pokemon_move_rows(s->id);
+    for (i = r.first; i < r.end; i++) {
+      if (pokemon_moves->pokemon_move_method_id[i] == 1 &&
+          (m = db_move_row(pokemon_moves->move_id[i]))) {
         for (found = false, j = 0; !found && j < s->levelup_moves.size(); j++) {
-          if (s->levelup_moves[j].move == pokemon_moves[i].move_id) {
+          if (s->levelup_moves[j].move == m) {
             found = true;
           }
         }
         if (!found) {
-          s->levelup_moves.push_back({ pokemon_moves[i].level,
-                                       pokemon_moves[i].move_id });
+          s->levelup_moves.push_back({ pokemon_moves->level[i], m });
         }
       }
     }
@@ -46,13 +52,60 @@ pokemon::pokemon(int level) : level(level)
     sort(s->levelup_moves.begin(), s->levelup_moves.end());
 
     // Also initialize base stats while we're here
-    s->base_stat[0] = pokemon_stats[pokemon_species_index * 6 - 5].base_stat;
-    s->base_stat[1] = pokemon_stats[pokemon_species_index * 6 - 4].base_stat;
-    s->base_stat[2] = pokemon_stats[pokemon_species_index * 6 - 3].base_stat;
-    s->base_stat[3] = pokemon_stats[pokemon_species_index * 6 - 2].base_stat;
-    s->base_stat[4] = pokemon_stats[pokemon_species_index * 6 - 1].base_stat;
-    s->base_stat[5] = pokemon_stats[pokemon_species_index * 6 - 0].base_stat;
+    memset(s->base_stat, 0, sizeof (s->base_stat));
+    r = db_pokemon_stat_rows(s->id);
+    for (i = r.first; i < r.end; i++) {
+      if (pokemon_stats->stat_id[i] >= 1 && pokemon_stats->stat_id[i] <= 6) {
+        s->base_stat[pokemon_stats->stat_id[i] - 1] =
+          pokemon_stats->base_stat[i];
+      }
+    }
+    s->loaded = true;
+  }
+
+  return s;
+}
+
+/* Loads every species up front.  After this, making a pokemon only reads *
+ * the database, so several threads can do it at once.                    */
+void pokemon_load_all_species(void)
+{
+  unsigned i;
+
+  for (i = 1; i < (unsigned) db_size(db_pokemon_species_csv); i++) {
+    pokemon_load_species(i);
+  }
+}
+
+pokemon::pokemon(int level) : level(level)
+{
+  // Subtract 1 and add 1 because array is 1-indexed
+  generate(rand() % (db_size(db_pokemon_species_csv) - 1) + 1,
+           NULL);
+}
+
+/* A pokemon of the given species (or a random one, if 0) drawing its *
+ * moves and IVs from rand_r(seed), or rand() if seed is NULL.        */
+pokemon::pokemon(int level, int species_index, unsigned int *seed) :
+  level(level)
+{
+  if (!species_index) {
+    species_index = (pokemon_rand(seed) %
+                     (db_size(db_pokemon_species_csv) - 1) + 1);
   }
+  generate(species_index, seed);
+}
+
+void pokemon::generate(int species_index, unsigned int *seed)
+{
+  pokemon_species_db *s;
+  db_range r;
+  unsigned i, j;
+  int k;
+
+  db = db_current();
+  pokemon_species_index = species_index;
+  s = pokemon_load_species(species_index);
 
   // Get pokemon's move(s).
   for (i = 0;
@@ -64,10 +117,10 @@ pokemon::pokemon(int level) : level(level)
   move_index[0] = move_index[1] = move_index[2] = move_index[3] = 0;
   // I don't think 0 moves is possible, but account for it to be safe
   if (i) {
-    move_index[0] = s->levelup_moves[rand() % i].move;
+    move_index[0] = s->levelup_moves[pokemon_rand(seed) % i].move;
     if (i != 1) {
       do {
-        j = rand() % i;
+        j = pokemon_rand(seed) % i;
       } while (s->levelup_moves[j].move == move_index[0]);
       move_index[1] = s->levelup_moves[j].move;
     }
@@ -75,7 +128,7 @@ pokemon::pokemon(int level) : level(level)
 
   // Calculate IVs
   for (i = 0; i < 6; i++) {
-    IV[i] = rand() & 0xf;
+    IV[i] = pokemon_rand(seed) & 0xf;
     effective_stat[i] = 5 + ((s->base_stat[i] + IV[i]) * 2 * level) / 100;
     if (i == 0) { // HP
       effective_stat[i] += 5 + level;
@@ -86,20 +139,33 @@ pokemon::pokemon(int level) : level(level)
   max_hp = effective_stat[stat_hp];
 
   // set type_ids and num_types
-  for (i = 0; i < 1676; i++) {
-    if (pokemon_types[i].pokemon_id == pokemon_species_index) {
-      type_ids.push_back(pokemon_types[i].type_id);
-    }
+  r = db_pokemon_type_rows(s->id);
+  for (k = r.first; k < r.end; k++) {
+    type_ids.push_back(pokemon_types->type_id[k]);
   }
   num_types = (int) type_ids.size();
 
-  shiny = (((rand() & 0x1fff) == 0x1fff) ? true : false);
-  gender = ((rand() & 0x1) ? gender_female : gender_male);
+  type_mask = 0;
+  for (i = 0; i < 19; i++) {
+    type_factor[i] = 100;
+  }
+  for (j = 0; j < type_ids.size(); j++) {
+    if (type_ids[j] > 0 && type_ids[j] < 19) {
+      type_mask |= 1U << type_ids[j];
+      for (i = 0; i < 19; i++) {
+        type_factor[i] = type_factor[i] * type_efficacy[i][type_ids[j]] / 100;
+      }
+    }
+  }
+  crit_threshold = s->base_stat[stat_speed] / 2;
+
+  shiny = (((pokemon_rand(seed) & 0x1fff) == 0x1fff) ? true : false);
+  gender = ((pokemon_rand(seed) & 0x1) ? gender_female : gender_male);
 }
 
 const char *pokemon::get_species() const
 {
-  return species[pokemon_species_index].identifier;
+  return db->species[pokemon_species_index].identifier;
 }
 
 int pokemon::get_hp() const
@@ -164,7 +230,7 @@ bool pokemon::is_shiny() const
 const char *pokemon::get_move(int i) const
 {
   if (i < 4 && move_index[i]) {
-    return moves[move_index[i]].identifier;
+    return db->moves[move_index[i]].identifier;
   } else {
     return "";
   }
@@ -183,7 +249,7 @@ int pokemon::get_num_moves() const
 {
   int count = 0;
   for (int i = 0; i < 4; i++) {
-    if (move_index[i] && strcmp(moves[move_index[i]].identifier, "") != 0) { 
+    if (move_index[i] && strcmp(db->moves[move_index[i]].identifier, "") != 0) { 
       count++; 
     }
   }
@@ -202,4 +268,24 @@ int pokemon::get_type_id(int i) const
 int pokemon::get_num_types() const 
 {
   return num_types;
-}
\ No newline at end of file
+}
+
+bool pokemon::has_type(int type) const
+{
+  return type > 0 && type < 19 && ((type_mask >> type) & 1);
+}
+
+int pokemon::get_crit_threshold() const
+{
+  return crit_threshold;
+}
+
+int pokemon::get_type_factor(int type) const
+{
+  return (type > 0 && type < 19) ? type_factor[type] : 100;
+}
+
+const db_version *pokemon::get_db() const
+{
+  return db.get();
+}
@@ -1,8 +1,12 @@
 #ifndef POKEMON_H
 # define POKEMON_H
 
+#include <stdint.h>
+#include <memory>
 #include <vector>
 
+struct db_version;
+
 enum pokemon_stat {
   stat_hp,
   stat_atk,
@@ -30,8 +34,20 @@ class pokemon {
   int max_hp;
   std::vector<int> type_ids;
   int num_types;
+  /* Worked out once here so do_battle_move() only looks them up: a bit  *
+   * per type this pokemon has (for STAB), the 0-255 roll under which it *
+   * lands a critical hit, and the damage factor in percent it takes     *
+   * from a move of each type (both of its types applied).               */
+  uint32_t type_mask;
+  int crit_threshold;
+  int16_t type_factor[19];
+  /* The pokedex it was made under; move_index and the species index *
+   * are rows of its tables, whatever has been loaded since.         */
+  std::shared_ptr<const db_version> db;
+  void generate(int species_index, unsigned int *seed);
  public:
   pokemon(int level);
+  pokemon(int level, int species_index, unsigned int *seed);
   const char *get_species() const;
   int get_hp() const;
   void set_hp(int hp);
@@ -50,6 +66,12 @@ class pokemon {
   int get_num_moves() const;
   int get_type_id(int i) const;
   int get_num_types() const;
+  bool has_type(int type) const;
+  int get_crit_threshold() const;
+  int get_type_factor(int type) const;
+  const db_version *get_db() const;
 };
 
+void pokemon_load_all_species(void);
+
 #endif
@@ -0,0 +1,88 @@
+#include <stdio.h>
+
+#include "replay.h"
+
+#define REPLAY_MAGIC   "poke327 replay"
+#define REPLAY_VERSION 1
+
+static FILE *record_file;
+static FILE *play_file;
+
+/* Returns 0 on success, non-zero if the file can't be created. */
+int replay_record_open(const char *path, uint32_t seed, uint32_t turn_limit)
+{
+  if (!(record_file = fopen(path, "w"))) {
+    perror(path);
+    return 1;
+  }
+
+  fprintf(record_file, "%s %d\nseed %u\nturns %u\n",
+          REPLAY_MAGIC, REPLAY_VERSION, seed, turn_limit);
+
+  return 0;
+}
+
+/* Reads the header of a recording and fills in the seed and turn limit *
+ * it was made with.  Returns 0 on success, non-zero on a bad file.     */
+int replay_play_open(const char *path, uint32_t *seed, uint32_t *turn_limit)
+{
+  int version;
+
+  if (!(play_file = fopen(path, "r"))) {
+    perror(path);
+    return 1;
+  }
+
+  if (fscanf(play_file, REPLAY_MAGIC " %d", &version) != 1 ||
+      version != REPLAY_VERSION ||
+      fscanf(play_file, " seed %u", seed) != 1 ||
+      fscanf(play_file, " turns %u", turn_limit) != 1) {
+    fprintf(stderr, "%s: not a version %d poke327 recording\n",
+            path, REPLAY_VERSION);
+    fclose(play_file);
+    play_file = NULL;
+
+    return 1;
+  }
+
+  return 0;
+}
+
+int replay_playing(void)
+{
+  return play_file != NULL;
+}
+
+/* Fetches the next recorded input, which must be of the given kind.      *
+ * Returns 0 on success, 1 when the recording has run out, and -1 if the  *
+ * next input is of a different kind, meaning the game has diverged from  *
+ * the recorded session.                                                  */
+int replay_next(char kind, int *value)
+{
+  char k;
+
+  if (fscanf(play_file, " %c %d", &k, value) != 2) {
+    return 1;
+  }
+
+  return k == kind ? 0 : -1;
+}
+
+void replay_record(char kind, int value)
+{
+  if (record_file) {
+    fprintf(record_file, "%c %d\n", kind, value);
+  }
+}
+
+void replay_close(void)
+{
+  if (record_file) {
+    fclose(record_file);
+    record_file = NULL;
+  }
+  if (play_file) {
+    fclose(play_file);
+    play_file = NULL;
+  }
+}
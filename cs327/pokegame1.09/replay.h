@@ -0,0 +1,31 @@
+#ifndef REPLAY_H
+# define REPLAY_H
+
+# include <stdint.h>
+
+/* Session recording.  A recording is the seed and turn limit the game   *
+ * was started with, followed by every input the game consumed, in       *
+ * order.  Since the game's only other source of nondeterminism is       *
+ * rand(), feeding the same inputs back after srand(seed) reproduces the *
+ * session exactly (same binary, same database).                         *
+ *                                                                       *
+ * The file is plain text, one input per line:                           *
+ *                                                                       *
+ *   poke327 replay 1                                                    *
+ *   seed 1666969087                                                     *
+ *   turns 0                                                             *
+ *   k 106          <- a key, as returned by getch()                     *
+ *   n -42          <- an integer typed at a prompt (fly coordinates)    */
+
+/* Kinds of recorded input */
+# define REPLAY_KEY 'k'
+# define REPLAY_INT 'n'
+
+int replay_record_open(const char *path, uint32_t seed, uint32_t turn_limit);
+int replay_play_open(const char *path, uint32_t *seed, uint32_t *turn_limit);
+int replay_playing(void);
+int replay_next(char kind, int *value);
+void replay_record(char kind, int value);
+void replay_close(void);
+
+#endif
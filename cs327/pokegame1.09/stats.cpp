@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "stats.h"
+
+/* Four buckets per power of two: the leading bit picks the octave and *
+ * the two bits below it pick the quarter.  Values under 4ns share the *
+ * first four buckets.                                                 */
+#define STATS_SUB_BITS 2
+#define STATS_BUCKETS  (64 << STATS_SUB_BITS)
+
+typedef struct stats_histogram {
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+  uint32_t bucket[STATS_BUCKETS];
+} stats_histogram_t;
+
+const char *stats_phase_name[num_stats_phases] = {
+  "turn",
+  "npc_moves",
+  "pathfind",
+  "render",
+  "new_map",
+  "smooth_height",
+  "map_terrain",
+  "build_paths",
+  "place_characters",
+};
+
+static stats_histogram_t stats[num_stats_phases];
+static uint64_t stats_idle_total;
+
+/* clock_gettime() rather than the TSC: it goes through the vDSO, so it *
+ * costs about as much as rdtsc does, and needs no calibration.         */
+uint64_t stats_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void stats_begin(stats_mark_t *m)
+{
+  m->start = stats_now();
+  m->idle = stats_idle_total;
+}
+
+/* Time since stats_begin(), less any time spent waiting for input */
+uint64_t stats_elapsed(const stats_mark_t *m)
+{
+  return (stats_now() - m->start) - (stats_idle_total - m->idle);
+}
+
+void stats_add_idle(uint64_t ns)
+{
+  stats_idle_total += ns;
+}
+
+static uint32_t stats_bucket(uint64_t ns)
+{
+  uint32_t msb;
+
+  if (ns < (1 << STATS_SUB_BITS)) {
+    return ns;
+  }
+
+  msb = 63 - __builtin_clzll(ns);
+
+  return (((msb - STATS_SUB_BITS + 1) << STATS_SUB_BITS) |
+          ((ns >> (msb - STATS_SUB_BITS)) & ((1 << STATS_SUB_BITS) - 1)));
+}
+
+/* Midpoint of the values that land in bucket b */
+static uint64_t stats_bucket_value(uint32_t b)
+{
+  uint32_t octave, quarter;
+  uint64_t low, width;
+
+  if (b < (1 << STATS_SUB_BITS)) {
+    return b;
+  }
+
+  octave = (b >> STATS_SUB_BITS) + STATS_SUB_BITS - 1;
+  quarter = b & ((1 << STATS_SUB_BITS) - 1);
+  width = 1ULL << (octave - STATS_SUB_BITS);
+  low = (1ULL << octave) + quarter * width;
+
+  return low + width / 2;
+}
+
+void stats_record(stats_phase_t p, uint64_t ns)
+{
+  stats[p].count++;
+  stats[p].total += ns;
+  if (ns > stats[p].max) {
+    stats[p].max = ns;
+  }
+  stats[p].bucket[stats_bucket(ns)]++;
+}
+
+void stats_end(const stats_mark_t *m, stats_phase_t p)
+{
+  stats_record(p, stats_elapsed(m));
+}
+
+static uint64_t stats_percentile(const stats_histogram_t *h, double q)
+{
+  uint64_t rank, seen;
+  uint32_t b;
+
+  if (!h->count) {
+    return 0;
+  }
+
+  rank = (uint64_t) (q * h->count + 0.999999);
+  for (seen = 0, b = 0; b < STATS_BUCKETS; b++) {
+    if ((seen += h->bucket[b]) >= rank) {
+      break;
+    }
+  }
+
+  /* Never claim more than was actually seen */
+  return stats_bucket_value(b) < h->max ? stats_bucket_value(b) : h->max;
+}
+
+void stats_summarize(stats_phase_t p, stats_summary_t *s)
+{
+  s->count = stats[p].count;
+  s->total = stats[p].total;
+  s->p50 = stats_percentile(&stats[p], 0.5);
+  s->p99 = stats_percentile(&stats[p], 0.99);
+  s->max = stats[p].max;
+}
+
+static FILE *stats_file;
+
+/* Opens the file stats_write() will write to.  Done up front so a bad *
+ * path is reported before the game rather than after it.  Returns 0   *
+ * on success, non-zero if the file can't be created.                  */
+int stats_open(const char *path)
+{
+  if (!(stats_file = fopen(path, "w"))) {
+    perror(path);
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Writes every phase's aggregates as JSON to the file from *
+ * stats_open(), if there is one, and closes it.            */
+int stats_write(void)
+{
+  stats_summary_t s;
+  int i;
+
+  if (!stats_file) {
+    return 0;
+  }
+
+  fprintf(stats_file, "{\n  \"unit\": \"ns\",\n  \"phases\": [");
+  for (i = 0; i < num_stats_phases; i++) {
+    stats_summarize((stats_phase_t) i, &s);
+    fprintf(stats_file, "%s\n    { \"name\": \"%s\", \"count\": %llu, "
+            "\"total\": %llu, \"mean\": %llu,\n"
+            "      \"p50\": %llu, \"p99\": %llu, \"max\": %llu }",
+            i ? "," : "", stats_phase_name[i],
+            (unsigned long long) s.count, (unsigned long long) s.total,
+            (unsigned long long) (s.count ? s.total / s.count : 0),
+            (unsigned long long) s.p50, (unsigned long long) s.p99,
+            (unsigned long long) s.max);
+  }
+  fprintf(stats_file, "\n  ]\n}\n");
+
+  i = fclose(stats_file);
+  stats_file = NULL;
+
+  return i;
+}
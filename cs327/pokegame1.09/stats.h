@@ -0,0 +1,70 @@
+#ifndef STATS_H
+# define STATS_H
+
+# include <stdint.h>
+
+/* Per-phase timing.  Each phase keeps a count, total, max, and a        *
+ * histogram with four buckets per power of two nanoseconds, which is    *
+ * enough to quote p50/p99 to within about 10%.  Time spent waiting on   *
+ * the keyboard (see stats_idle) is left out of every phase, so a phase  *
+ * that contains a prompt, like a turn with a battle in it, measures     *
+ * only the work the game did.                                           */
+
+typedef enum stats_phase {
+  stats_turn,             /* PC turn to PC turn, all of it */
+  stats_npc_moves,        /* All NPC moves made between two PC turns */
+  stats_pathfind,
+  stats_render,
+  stats_new_map,          /* Generating a map, including the four below */
+  stats_smooth_height,
+  stats_map_terrain,
+  stats_build_paths,
+  stats_place_characters,
+  num_stats_phases
+} stats_phase_t;
+
+extern const char *stats_phase_name[num_stats_phases];
+
+typedef struct stats_mark {
+  uint64_t start;
+  uint64_t idle;
+} stats_mark_t;
+
+typedef struct stats_summary {
+  uint64_t count;
+  uint64_t total;
+  uint64_t p50;
+  uint64_t p99;
+  uint64_t max;
+} stats_summary_t;
+
+uint64_t stats_now(void);
+void stats_begin(stats_mark_t *m);
+uint64_t stats_elapsed(const stats_mark_t *m);
+void stats_record(stats_phase_t p, uint64_t ns);
+void stats_end(const stats_mark_t *m, stats_phase_t p);
+void stats_add_idle(uint64_t ns);
+void stats_summarize(stats_phase_t p, stats_summary_t *s);
+int stats_open(const char *path);
+int stats_write(void);
+
+/* Times the rest of the enclosing block as phase p */
+class stats_timer {
+ private:
+  stats_mark_t mark;
+  stats_phase_t phase;
+ public:
+  stats_timer(stats_phase_t p) : phase(p) { stats_begin(&mark); }
+  ~stats_timer() { stats_end(&mark, phase); }
+};
+
+/* Marks the rest of the enclosing block as waiting on the player */
+class stats_idle {
+ private:
+  uint64_t start;
+ public:
+  stats_idle() : start(stats_now()) {}
+  ~stats_idle() { stats_add_idle(stats_now() - start); }
+};
+
+#endif
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <atomic>
+
+#include "trace.h"
+#include "stats.h"
+
+/* Per-thread ring size, a power of two.  The writer drains every    *
+ * TRACE_FLUSH_NS, and the game makes well under a million events a  *
+ * second, so a ring only fills if the writer can't keep up; then    *
+ * the game waits for room rather than drop events, since a lost     *
+ * begin or end would leave the rest of that thread's trace garbled. */
+#define TRACE_RING_SIZE (1 << 16)
+#define TRACE_MAX_THREADS 64
+#define TRACE_FLUSH_NS 10000000
+
+/* A ring is in use by its thread, retired when the thread exits, and *
+ * free once the writer has drained it after that, for the next new   *
+ * thread to take.                                                    */
+typedef enum trace_ring_state {
+  trace_ring_in_use,
+  trace_ring_retired,
+  trace_ring_free
+} trace_ring_state_t;
+
+typedef struct trace_event_rec {
+  uint64_t ts;
+  const char *name;
+  const char *cat;
+  char phase;
+} trace_event_rec_t;
+
+/* Single producer (the owning thread), single consumer (the writer) */
+typedef struct trace_ring {
+  std::atomic<uint32_t> head; /* Next slot to write; only the owner stores */
+  std::atomic<uint32_t> tail; /* Next slot to read; only the writer stores */
+  std::atomic<int> state;     /* A trace_ring_state_t */
+  uint32_t tid;
+  trace_event_rec_t event[TRACE_RING_SIZE];
+} trace_ring_t;
+
+std::atomic<int> trace_enabled;
+
+static FILE *trace_file;
+static uint64_t trace_epoch;
+static uint32_t trace_written;
+static pthread_t trace_writer;
+static std::atomic<int> trace_stop;
+static std::atomic<trace_ring_t *> trace_rings[TRACE_MAX_THREADS];
+static std::atomic<uint32_t> trace_num_rings;
+static std::atomic<uint32_t> trace_num_tids;
+static std::atomic<int> trace_refused;
+
+/* Retires the thread's ring when the thread exits */
+class trace_ring_owner {
+ public:
+  trace_ring_t *ring;
+  ~trace_ring_owner()
+  {
+    if (ring) {
+      ring->state.store(trace_ring_retired, std::memory_order_release);
+    }
+  }
+};
+
+static thread_local trace_ring_owner trace_my_ring;
+
+/* Gives the calling thread a free ring, or else claims a slot for a  *
+ * new one.  The writer skips a slot until its ring is published, and *
+ * a free ring goes to whichever thread swaps its state first, so     *
+ * neither needs a lock.  Returns NULL, having warned the first time, *
+ * if TRACE_MAX_THREADS threads already have rings.                   */
+static trace_ring_t *trace_new_ring()
+{
+  trace_ring_t *r;
+  uint32_t i;
+  int state;
+
+  for (i = 0; i < trace_num_rings.load() && i < TRACE_MAX_THREADS; i++) {
+    state = trace_ring_free;
+    if ((r = trace_rings[i].load(std::memory_order_acquire)) &&
+        r->state.compare_exchange_strong(state, trace_ring_in_use)) {
+      r->tid = trace_num_tids.fetch_add(1) + 1;
+      return r;
+    }
+  }
+
+  if (trace_num_rings.load() >= TRACE_MAX_THREADS ||
+      (i = trace_num_rings.fetch_add(1)) >= TRACE_MAX_THREADS) {
+    if (!trace_refused.exchange(1)) {
+      fprintf(stderr, "trace: more than %d threads tracing at once; "
+              "dropping the events of the rest\n", TRACE_MAX_THREADS);
+    }
+    return NULL;
+  }
+
+  r = new trace_ring_t;
+  r->head.store(0);
+  r->tail.store(0);
+  r->state.store(trace_ring_in_use);
+  r->tid = trace_num_tids.fetch_add(1) + 1;
+  trace_rings[i].store(r, std::memory_order_release);
+
+  return r;
+}
+
+void trace_event(char phase, const char *name, const char *cat)
+{
+  trace_ring_t *r;
+  uint32_t head;
+
+  if (!(r = trace_my_ring.ring) &&
+      !(r = trace_my_ring.ring = trace_new_ring())) {
+    return;
+  }
+
+  /* Once the writer is gone nothing makes room, so give up then */
+  head = r->head.load(std::memory_order_relaxed);
+  while (head - r->tail.load(std::memory_order_acquire) == TRACE_RING_SIZE) {
+    if (!trace_enabled.load(std::memory_order_relaxed)) {
+      return;
+    }
+    sched_yield();
+  }
+
+  r->event[head & (TRACE_RING_SIZE - 1)].ts = stats_now();
+  r->event[head & (TRACE_RING_SIZE - 1)].name = name;
+  r->event[head & (TRACE_RING_SIZE - 1)].cat = cat;
+  r->event[head & (TRACE_RING_SIZE - 1)].phase = phase;
+  r->head.store(head + 1, std::memory_order_release);
+}
+
+static void trace_drain(trace_ring_t *r)
+{
+  uint32_t head, tail;
+  trace_event_rec_t *e;
+
+  head = r->head.load(std::memory_order_acquire);
+  for (tail = r->tail.load(std::memory_order_relaxed); tail != head; tail++) {
+    e = &r->event[tail & (TRACE_RING_SIZE - 1)];
+    fprintf(trace_file, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\","
+            "\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+            trace_written++ ? "," : "", e->name, e->cat, e->phase,
+            (e->ts - trace_epoch) / 1000.0, r->tid);
+  }
+  r->tail.store(tail, std::memory_order_release);
+}
+
+/* A retired ring is free once drained, since nothing will add to it */
+static void trace_drain_all()
+{
+  trace_ring_t *r;
+  uint32_t i;
+  int state;
+
+  for (i = 0; i < trace_num_rings.load() && i < TRACE_MAX_THREADS; i++) {
+    if ((r = trace_rings[i].load(std::memory_order_acquire))) {
+      state = r->state.load(std::memory_order_acquire);
+      trace_drain(r);
+      if (state == trace_ring_retired) {
+        r->state.store(trace_ring_free, std::memory_order_release);
+      }
+    }
+  }
+}
+
+static void *trace_writer_func(void *)
+{
+  struct timespec ts;
+
+  ts.tv_sec = 0;
+  ts.tv_nsec = TRACE_FLUSH_NS;
+
+  while (!trace_stop.load()) {
+    trace_drain_all();
+    nanosleep(&ts, NULL);
+  }
+  trace_drain_all();
+
+  return NULL;
+}
+
+/* Starts tracing to path.  Returns 0 on success, non-zero on failure. *
+ * The trace is finished by trace_close(), which also runs at exit.    */
+int trace_open(const char *path)
+{
+  if (!(trace_file = fopen(path, "w"))) {
+    perror(path);
+    return 1;
+  }
+
+  fprintf(trace_file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  trace_epoch = stats_now();
+
+  if (pthread_create(&trace_writer, NULL, trace_writer_func, NULL)) {
+    perror("pthread_create");
+    fclose(trace_file);
+    trace_file = NULL;
+    return 1;
+  }
+
+  trace_enabled = 1;
+  atexit(trace_close);
+
+  return 0;
+}
+
+/* Other threads may still be tracing, so their rings are left alone */
+void trace_close(void)
+{
+  if (!trace_file) {
+    return;
+  }
+
+  trace_enabled = 0;
+  trace_stop.store(1);
+  pthread_join(trace_writer, NULL);
+
+  fprintf(trace_file, "\n]}\n");
+  fclose(trace_file);
+  trace_file = NULL;
+}
@@ -0,0 +1,55 @@
+#ifndef TRACE_H
+# define TRACE_H
+
+# include <atomic>
+
+/* Opt-in event tracing (--trace <file>) in Chrome trace JSON format; load *
+ * the file in chrome://tracing or ui.perfetto.dev.                        *
+ *                                                                         *
+ * trace_begin()/trace_end() append to a ring buffer owned by the calling  *
+ * thread, with no locks; a background thread drains every thread's ring   *
+ * into the file.  When tracing is off they cost one test of a global.     *
+ * Names and categories are stored by pointer and written out later, so    *
+ * they must be string literals or otherwise live for the whole run.       *
+ *                                                                         *
+ * A ring lives until the process exits, so a thread still tracing when    *
+ * trace_close() runs (at exit, say) never writes to freed memory; its     *
+ * last events are just not written out.  When its thread exits, a ring    *
+ * is drained and handed to the next thread to start tracing, so there are *
+ * only ever as many rings as threads tracing at once.  Past               *
+ * TRACE_MAX_THREADS (trace.cpp) of those, the events of the rest are      *
+ * dropped, with a warning.                                                */
+
+extern std::atomic<int> trace_enabled;
+
+int trace_open(const char *path);
+void trace_close(void);
+void trace_event(char phase, const char *name, const char *cat);
+
+static inline void trace_begin(const char *name, const char *cat)
+{
+  if (trace_enabled.load(std::memory_order_relaxed)) {
+    trace_event('B', name, cat);
+  }
+}
+
+static inline void trace_end(const char *name, const char *cat)
+{
+  if (trace_enabled.load(std::memory_order_relaxed)) {
+    trace_event('E', name, cat);
+  }
+}
+
+/* Traces the rest of the enclosing block */
+class trace_scope {
+ private:
+  const char *name, *cat;
+ public:
+  trace_scope(const char *n, const char *c) : name(n), cat(c)
+  {
+    trace_begin(name, cat);
+  }
+  ~trace_scope() { trace_end(name, cat); }
+};
+
+#endif
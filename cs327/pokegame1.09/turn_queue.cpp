@@ -0,0 +1,77 @@
+#include <string.h>
+#include <assert.h>
+
+#include "turn_queue.h"
+#include "poke327.h"
+
+#define slot(t) ((t) & (TURN_QUEUE_SLOTS - 1))
+
+void turn_queue_init(turn_queue_t *q)
+{
+  memset(q, 0, sizeof (*q));
+}
+
+/* Frees every character left in the queue, parked or not, except the PC */
+void turn_queue_delete(turn_queue_t *q)
+{
+  character *c;
+
+  while ((c = turn_queue_remove_min(q))) {
+    delete_character(c);
+  }
+  while ((c = q->dormant)) {
+    q->dormant = c->turn_next;
+    delete_character(c);
+  }
+}
+
+void turn_queue_insert(turn_queue_t *q, character *c, int t)
+{
+  /* Nothing is due yet, or c is due before anyone else: start there */
+  if (!q->size || t < q->now) {
+    q->now = t;
+  }
+
+  /* Otherwise c would share a slot with a character due a lap later */
+  assert(t - q->now < TURN_QUEUE_SLOTS);
+
+  c->turn_next = NULL;
+  if (q->head[slot(t)]) {
+    q->tail[slot(t)]->turn_next = c;
+  } else {
+    q->head[slot(t)] = c;
+  }
+  q->tail[slot(t)] = c;
+  q->size++;
+}
+
+void turn_queue_park(turn_queue_t *q, character *c)
+{
+  c->turn_next = q->dormant;
+  q->dormant = c;
+}
+
+character *turn_queue_peek_min(turn_queue_t *q)
+{
+  if (!q->size) {
+    return NULL;
+  }
+
+  while (!q->head[slot(q->now)]) {
+    q->now++;
+  }
+
+  return q->head[slot(q->now)];
+}
+
+character *turn_queue_remove_min(turn_queue_t *q)
+{
+  character *c;
+
+  if ((c = turn_queue_peek_min(q))) {
+    q->head[slot(q->now)] = c->turn_next;
+    q->size--;
+  }
+
+  return c;
+}
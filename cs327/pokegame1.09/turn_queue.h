@@ -0,0 +1,47 @@
+#ifndef TURN_QUEUE_H
+# define TURN_QUEUE_H
+
+# include <stdint.h>
+
+/* The order characters take their turns in, one per map.                 *
+ *                                                                        *
+ * A character's next turn only ever comes one entry of move_cost[] after *
+ * its last, so everyone in the queue is due within TURN_QUEUE_SLOTS      *
+ * ticks of the earliest.  That makes a timing wheel enough: slot tick %  *
+ * TURN_QUEUE_SLOTS holds a FIFO list of the characters due at that tick, *
+ * linked through character::turn_next, and finding the minimum means     *
+ * stepping forward from the last tick served to the next non-empty slot. *
+ * Insert and remove are O(1), and nothing is allocated.                  *
+ *                                                                        *
+ * Characters due at the same tick come out in the order they went in.    *
+ * That's the order of a heap that breaks ties between equal ticks by an  *
+ * insertion sequence number (turn_heap in bench.cpp), so the two give    *
+ * the same seeded game.                                                  *
+ *                                                                        *
+ * A character whose turns can't change anything (a sentry) can be parked *
+ * instead.  It takes no turns, so the cost of a turn tracks only the     *
+ * characters that do something, but the queue still owns it and frees    *
+ * it with the rest.                                                      */
+
+/* Must be a power of two, and more than the largest finite move_cost[]. */
+# define TURN_QUEUE_SLOTS 64
+
+class character;
+
+typedef struct turn_queue {
+  character *head[TURN_QUEUE_SLOTS];
+  character *tail[TURN_QUEUE_SLOTS];
+  character *dormant;  /* Parked characters, linked through turn_next */
+  int now;             /* Tick of the last character removed or peeked at */
+  uint32_t size;       /* Characters queued, not counting the parked */
+} turn_queue_t;
+
+void turn_queue_init(turn_queue_t *q);
+void turn_queue_delete(turn_queue_t *q);
+/* Queues c to take a turn at tick t */
+void turn_queue_insert(turn_queue_t *q, character *c, int t);
+void turn_queue_park(turn_queue_t *q, character *c);
+character *turn_queue_peek_min(turn_queue_t *q);
+character *turn_queue_remove_min(turn_queue_t *q);
+
+#endif